@@ -14,11 +14,43 @@
 #include <semaphore.h>
 #include <pthread.h>
 #include <stdarg.h>         /* for functions take a variable number of arguments */
+#include <stdint.h>
 
 /* ==================================== MACRO VARIABLES ============================================================= */
 
-#define NB_OWNERS           20
-#define NB_LOCKS            10
+#define RL_SEGMENT_SIZE     (64 * 1024)     /* shared memory grows by segments of this size */
+#define RL_MAX_SEGMENTS     1024            /* segments a shared object can hold */
+#define RL_PAGE_SIZE        4096
+#define RL_FAST_SLOTS       64              /* read locks taken without the file mutex */
+#define RL_INHERIT_SLOTS    32              /* forks waiting for their read locks to be inherited */
+#define RL_CACHE_LINE       64              /* alignment of the regions of rl_open_file written by different parties */
+
+#define RL_HOLD_SIZES       16              /* hold histogram: size class c counts regions of [16^c..16^(c+1)[ bytes */
+#define RL_HOLD_TIMES       32              /* hold histogram: time class t > 0 counts holds of [2^(t-1)..2^t[ us */
+
+#define RL_MAGIC            0x524c4b46u     /* "FKLR", first word of every shared object */
+#define RL_LAYOUT_VERSION   8               /* bumped on each change of the shared object layout */
+
+/* log levels, see rl_set_log_level */
+#define RL_LOG_NONE         0
+#define RL_LOG_ERROR        1
+#define RL_LOG_WARN         2
+#define RL_LOG_INFO         3
+#define RL_LOG_DEBUG        4
+
+/* fairness policies, see rl_set_policy */
+#define RL_POLICY_READERS   0
+#define RL_POLICY_WRITERS   1
+#define RL_POLICY_FIFO      2
+
+/* lock ownership modes of a descriptor, see rl_descriptor */
+#define RL_OWNER_THREAD     0x1             /* each thread using the descriptor is a distinct lock owner */
+#define RL_OWNER_TOKEN      0x2             /* locks are owned by the descriptor token */
+
+/* kinds of rl_snapshot_entry, see rl_snapshot */
+#define RL_SNAPSHOT_LOCK    0               /* a lock of the lock table and one of its owners */
+#define RL_SNAPSHOT_FAST    1               /* a read lock held in a fast slot */
+#define RL_SNAPSHOT_WAITER  2               /* an F_SETLKW request waiting for a region */
 
 /* ======================================= STRUCTURES =============================================================== */
 
@@ -26,33 +58,207 @@ typedef struct
 {
     pid_t   proc;     /* pid of process */
     int     des;      /* file descripor */
+    uint64_t token;   /* thread or handle owning the locks, 0 - the descriptor owns them */
 } owner;
 
+/* every pooled structure starts with the int link used by the pool free list */
+
 typedef struct
 {
-    int             next_lock;
+    int             next;       /* next owner of the same lock */
+    owner           own;
+    uint64_t        since;      /* acquisition time if hold times are measured, 0 otherwise */
+} rl_owner;
+
+typedef struct
+{
+    int             next_lock;  /* next lock in offset order */
+    int             prev_lock;  /* previous lock in offset order */
+    int             left;       /* interval index: left child */
+    int             right;      /* interval index: right child */
+    unsigned int    priority;   /* interval index: heap priority */
+    off_t           max_end;    /* interval index: max end offset of the subtree */
     off_t           starting_offset;
     off_t           len;
     short           type;   //F_RDLCK or F_WRLCK
     size_t          nb_owners;
-    owner           lock_owners[NB_OWNERS];
+    int             owners;     /* first rl_owner of the lock */
 } rl_lock;
 
 typedef struct
 {
-    int             first;
-    rl_lock         lock_table[NB_LOCKS];
-    pthread_mutex_t mutex;
-    pthread_cond_t  cond;
-    int             blockCnt;
-    int             refCnt;
+    int             next;       /* next waiter in arrival order */
+    int             prev;       /* previous waiter in arrival order */
+    owner           own;        /* owner of the request */
+    short           type;       /* requested lock type */
+    off_t           start;      /* requested region */
+    off_t           len;
+    int             wake;       /* futex word, set to 1 when the request may be granted */
+    unsigned int    visit;      /* last deadlock detection pass that went through the waiter */
+} rl_waiter;
+
+typedef struct
+{
+    int             next;       /* next registered process */
+    pid_t           pid;
+    int             nb_owners;  /* lock owners of the process */
+} rl_proc;
+
+typedef struct
+{
+    _Alignas(RL_CACHE_LINE)
+    int             state;      /* RL_FAST_FREE, RL_FAST_HELD or RL_FAST_BUSY(pid), one slot per cache line */
+    owner           own;
+    off_t           start;
+    off_t           len;
+    uint64_t        acquisitions; /* read locks granted in the slot, counted here to keep them off a shared line */
+    uint64_t        since;      /* acquisition time if hold times are measured, 0 otherwise */
+} rl_fast_lock;
+
+typedef struct
+{
+    int             first_free;         /* free list of slots */
+    int             nb_slots;           /* slots carved from segments */
+    int             slot_size;
+    int             slots_per_segment;
+    int             nb_segments;
+    int             segments[RL_MAX_SEGMENTS]; /* arena segments owned by the pool */
+} rl_pool;
+
+typedef struct
+{
+    int             state;      /* RL_INHERIT_FREE, RL_INHERIT_BUSY or RL_INHERIT_READY */
+    pid_t           parent;     /* read locks of parent are inherited by child */
+    pid_t           child;
+} rl_inherit;
+
+/* lock statistics of a file, cumulative since its shared object was created */
+struct rl_stats
+{
+    uint64_t        acquisitions;       /* read and write locks granted */
+    uint64_t        conflicts;          /* requests found in conflict with a lock or a queued waiter */
+    uint64_t        waits;              /* requests queued to wait */
+    uint64_t        wait_ns;            /* total time spent queued */
+    uint64_t        max_wait_ns;        /* longest time spent queued */
+    uint64_t        wakeups;            /* waiters woken up before their timeout, by a release or a signal */
+    uint64_t        spurious_wakeups;   /* wakeups finding the request still in conflict */
+    uint64_t        timeouts;           /* waits ended by RL_LIVENESS_PERIOD or the deadline to check the holders */
+    uint64_t        merges;             /* locks joined with a new region of the same owner */
+    uint64_t        splits;             /* locks cut by an unlock of part of their region */
+};
+
+/* lock hold times per region size, see rl_set_hold_histogram */
+struct rl_holds
+{
+    uint64_t        counts[RL_HOLD_SIZES][RL_HOLD_TIMES]; /* time class 0 counts holds under 1 us */
+};
+
+/* a row of a snapshot: an owner of a lock, or a waiting request */
+typedef struct
+{
+    short           kind;       /* RL_SNAPSHOT_LOCK, RL_SNAPSHOT_FAST or RL_SNAPSHOT_WAITER */
+    short           type;       /* F_RDLCK or F_WRLCK */
+    off_t           start;
+    off_t           len;        /* 0 - to the end of file */
+    pid_t           pid;        /* owner of the lock or of the request */
+    int             des;        /* descriptor of the owner */
+    uint64_t        token;      /* owner token (RL_OWNER_THREAD, RL_OWNER_TOKEN), 0 otherwise */
+} rl_snapshot_entry;
+
+/* state of a file at one version of its lock table, filled by rl_snapshot */
+struct rl_snapshot
+{
+    dev_t               dev;        /* identity of the locked file */
+    ino_t               ino;
+    uint32_t            version;    /* RL_LAYOUT_VERSION of the shared object */
+    pid_t               creator;    /* process which created the shared object */
+    int                 refs;       /* descriptors of all processes using the file */
+    int                 policy;     /* RL_POLICY_* */
+    unsigned int        seq;        /* lock table version the snapshot was taken at */
+    struct rl_stats     stats;
+    size_t              nb_entries; /* entries written */
+    rl_snapshot_entry   entries[];  /* locks in offset order, fast locks, then waiters in arrival order */
+};
+
+/* the shared object header: each region written by different parties starts its own cache line */
+typedef struct
+{
+    /* identity, written by the creator only */
+    uint32_t        magic;      /* RL_MAGIC */
+    uint32_t        version;    /* RL_LAYOUT_VERSION */
+    int             state;      /* RL_STATE_*, futex word late joiners wait on while the creator initializes */
+    pid_t           creator;    /* process initializing the object */
+    dev_t           dev;        /* identity of the locked file, names the shared object */
+    ino_t           ino;
+    int             hold_tracking;  /* read mostly: hold times are measured, see rl_set_hold_histogram */
+
+    /* file mutex */
+    _Alignas(RL_CACHE_LINE)
+    pthread_mutex_t mutex;          /* robust: a process dying while holding it doesn't block others */
+
+    /* lock table, modified under the mutex */
+    _Alignas(RL_CACHE_LINE)
+    unsigned int    seq;            /* odd while the mutex holder may modify the lock table, readers validate with it */
+    int             first;          /* lock with the lowest starting offset */
+    int             root;           /* root of the interval index */
+    unsigned int    seed;           /* priority generator of the interval index */
+    int             nb_segments;    /* arena segments in use, the object is RL_HEADER_SIZE + nb_segments * RL_SEGMENT_SIZE */
+    int             first_proc;     /* processes owning locks */
+
+    /* waiters queue, modified under the mutex */
+    _Alignas(RL_CACHE_LINE)
+    int             first_waiter;   /* F_SETLKW requests waiting, in arrival order */
+    int             last_waiter;
+    int             blockCnt;       /* number of waiters */
+    unsigned int    visit_epoch;    /* deadlock detection passes, marks waiters already explored */
+    int             policy;         /* RL_POLICY_*, how requests rank against queued waiters */
+
+    /* references, atomic counter modified by open, dup, fork and close without the mutex */
+    _Alignas(RL_CACHE_LINE)
+    int             refCnt;         /* 0 - last reference is gone, the object can't be joined any more */
+
+    /* fast path, modified without the mutex */
+    _Alignas(RL_CACHE_LINE)
+    unsigned int    fast_state;     /* RL_FAST_SLOW | RL_FAST_DRAINED flags */
+    rl_fast_lock    fast_locks[RL_FAST_SLOTS];
+
+    /* inheritance, reserved by forking parents without the mutex and resolved by the next mutex holder */
+    _Alignas(RL_CACHE_LINE)
+    int             nb_inherits;    /* records taken, some may still wait for the child pid */
+    rl_inherit      inherits[RL_INHERIT_SLOTS];
+
+    /* statistics, relaxed atomic counters modified without the mutex */
+    _Alignas(RL_CACHE_LINE)
+    struct rl_stats stats;
+    _Alignas(RL_CACHE_LINE)
+    struct rl_holds holds;
+
+    /* pools, modified under the mutex */
+    _Alignas(RL_CACHE_LINE)
+    rl_pool         lock_pool;
+    rl_pool         owner_pool;
+    rl_pool         waiter_pool;
+    rl_pool         proc_pool;
 } rl_open_file;
 
+/* arena segments are mapped right after the page aligned header */
+#define RL_HEADER_SIZE      ((sizeof(rl_open_file) + RL_PAGE_SIZE - 1) / RL_PAGE_SIZE * RL_PAGE_SIZE)
+/* address space reserved by each mapping, so growth never moves rl_open_file */
+#define RL_MAP_SIZE         (RL_HEADER_SIZE + (size_t)RL_MAX_SEGMENTS * RL_SEGMENT_SIZE)
+
 
+/**
+ * Locks are owned by the (process, descriptor) pair, all the threads using a descriptor share them.
+ * Setting flags to RL_OWNER_THREAD makes each thread a distinct owner, RL_OWNER_TOKEN makes the owner the token,
+ * so copies of a descriptor with different tokens are distinct handles. Closing the descriptor releases the locks
+ * of all its owners.
+ */
 typedef struct
 {
     int             d;
     rl_open_file    *f;
+    int             flags;      /* RL_OWNER_THREAD, RL_OWNER_TOKEN or 0 */
+    uint64_t        token;      /* lock owner with RL_OWNER_TOKEN */
 } rl_descriptor;
 
 ///////////////////////////////////         RL_LIBRARY FUNCTIONS       /////////////////////////////////////////////////
@@ -112,21 +318,157 @@ rl_descriptor rl_dup2(rl_descriptor lfd, int newd);
 pid_t rl_fork();
 
 /**
- * Performs an advisory lock. Used to get or release a region lock 
- * (does not provide the F_GETLK functionality of the fcntl function)
+ * Performs an advisory lock. Used to get or release a region lock, or to test it
  * @param lfd rl library file descriptor
  * @param cmd command to execute by fcntl: 
  * F_SETLK (if a conflicting lock is held by another process, returns -1) 
  * or 
- * F_SETLKW (if a conflicting lock is held on the file, then wait for that lock to be released))
+ * F_SETLKW (if a conflicting lock is held on the file, then wait for that lock to be released),
+ * returns -1 with errno EDEADLK if the holders are themselves waiting, directly or not, for a lock of lfd)
+ * or
+ * F_GETLK (lck is replaced by a conflicting lock of another owner, its l_type is set to F_UNLCK if there is none,
+ * the lock table is read without taking the file mutex, returns -1 with errno EAGAIN if writers keep changing it)
+ * @param lck pointer to lock structure, l_len 0 locks up to the end of file however far it grows
+ * @return 0 - success, −1 otherwise (errno EINVAL for a region before the start of file, EOVERFLOW past OFFSET_MAX)
+ */
+int rl_fcntl(rl_descriptor lfd, int cmd, struct flock *lck);
+
+/**
+ * rl_fcntl with a bounded wait: a F_SETLKW request not granted at abs_deadline fails with ETIMEDOUT 
+ * and leaves the waiters queue
+ * @param lfd rl library file descriptor
+ * @param cmd F_SETLK or F_SETLKW (see rl_fcntl)
  * @param lck pointer to lock structure
+ * @param abs_deadline absolute CLOCK_MONOTONIC time, tv_nsec in [0..1e9[, NULL to wait forever
+ * @return 0 - success, −1 otherwise (errno ETIMEDOUT if the deadline has passed, EDEADLK as with rl_fcntl,
+ * EINVAL for another cmd or a deadline out of range)
+ */
+int rl_fcntl_timed(rl_descriptor lfd, int cmd, struct flock *lck, const struct timespec *abs_deadline);
+
+/**
+ * Lists locks of other owners conflicting with a request, without taking the file mutex: the lock table is read
+ * through a versioned snapshot, read again if a writer changed it meanwhile.
+ * @param lfd rl library file descriptor
+ * @param lck request: F_RDLCK or F_WRLCK type and region
+ * @param conflicts [out] conflicting locks: type, region (SEEK_SET) and pid of an owner
+ * @param max capacity of conflicts
+ * @return number of conflicting locks written (at most max), −1 otherwise (errno EAGAIN if writers kept changing 
+ * the table during every read, like rl_snapshot)
+ */
+int rl_query_conflicts(rl_descriptor lfd, const struct flock *lck, struct flock *conflicts, size_t max);
+
+/**
+ * Performs a set of advisory locks at once: either every region is granted or none is.
+ * Regions are sorted and coalesced, then applied under a single acquisition of the file mutex: 
+ * unlocks first, then read locks, then write locks (a region in both read and write set ends up written).
+ * @param lfd rl library file descriptor
+ * @param cmd F_SETLK (if a region conflicts, returns -1 and nothing is changed) 
+ * or 
+ * F_SETLKW (wait until every region can be granted)
+ * @param locks regions to lock or unlock (F_RDLCK, F_WRLCK, F_UNLCK), the array isn't modified
+ * @param n number of regions
  * @return 0 - success, −1 otherwise
  */
-int rl_fcntl(rl_descriptor lfd, int cmd, struct flock *lck);
+int rl_fcntl_batch(rl_descriptor lfd, int cmd, const struct flock *locks, size_t n);
+
+/**
+ * Selects how requests of all processes using the file rank against the F_SETLKW waiters queued on it.
+ * RL_POLICY_READERS (default): a request compatible with the holders is granted, readers may starve a waiting writer.
+ * RL_POLICY_WRITERS: read requests also wait for the queued writers they conflict with, writers keep arrival order.
+ * RL_POLICY_FIFO: a request waits for every conflicting request queued before it.
+ * A holder never waits for the waiters its own locks are blocking.
+ * @param lfd rl library file descriptor
+ * @param policy RL_POLICY_READERS, RL_POLICY_WRITERS or RL_POLICY_FIFO
+ * @return 0 - success, −1 otherwise
+ */
+int rl_set_policy(rl_descriptor lfd, int policy);
+
+/**
+ * Turns the read lock of lfd on a region into a write lock without releasing it. The lock type is changed in place
+ * if lfd is the only holder of exactly this region, otherwise the region is locked for writing as rl_fcntl does.
+ * A waiting upgrade is queued ahead of the other waiters. The locks of lfd must cover the whole region.
+ * @param lfd rl library file descriptor
+ * @param cmd F_SETLK (if another owner holds a lock on the region, returns -1) or F_SETLKW (wait for it)
+ * @param lck region (l_whence, l_start, l_len), l_type is ignored
+ * @return 0 - success, −1 otherwise (errno ENOLCK if a part of the region isn't locked by lfd)
+ */
+int rl_upgrade(rl_descriptor lfd, int cmd, struct flock *lck);
+
+/**
+ * Turns the write lock of lfd on a region into a read lock without releasing it, waiting readers are woken up.
+ * The locks of lfd must cover the whole region.
+ * @param lfd rl library file descriptor
+ * @param lck region (l_whence, l_start, l_len), l_type is ignored
+ * @return 0 - success, −1 otherwise (errno ENOLCK if a part of the region isn't locked by lfd)
+ */
+int rl_downgrade(rl_descriptor lfd, struct flock *lck);
+
+/**
+ * Reads the lock statistics of the file without taking the file mutex, so any process can sample them while the
+ * file is in use. Counters are read one by one and may be a few operations apart from each other.
+ * @param lfd rl library file descriptor
+ * @param stats [out] counters
+ * @return 0 - success, −1 otherwise
+ */
+int rl_stats(rl_descriptor lfd, struct rl_stats *stats);
+
+/**
+ * Starts or stops measuring how long locks of the file are held by all processes using it. Once started, each
+ * release adds the hold time to a histogram per region size; locks joined into one keep the earliest acquisition.
+ * @param lfd rl library file descriptor
+ * @param enable true - start, false - stop (the histogram is kept)
+ * @return 0 - success, −1 otherwise
+ */
+int rl_set_hold_histogram(rl_descriptor lfd, bool enable);
+
+/**
+ * Reads the hold time histogram of the file without taking the file mutex.
+ * @param lfd rl library file descriptor
+ * @param holds [out] counters
+ * @return 0 - success, −1 otherwise
+ */
+int rl_hold_histogram(rl_descriptor lfd, struct rl_holds *holds);
+
+/**
+ * Takes a consistent snapshot of the locks, owners, waiters and references of the file without the file mutex:
+ * the tables are read between two reads of an unchanged version, fast locks are read one by one.
+ * @param lfd rl library file descriptor
+ * @param buffer [out] struct rl_snapshot followed by as many entries as fit (malloc alignment)
+ * @param size size of buffer
+ * @return size of the whole snapshot, the snapshot is complete if it isn't greater than size, otherwise call again 
+ * with a larger buffer; −1 in case of error (errno EAGAIN - the tables kept changing, try again)
+ */
+ssize_t rl_snapshot(rl_descriptor lfd, void *buffer, size_t size);
+
+/**
+ * Same as rl_snapshot for a shared object given by name ("/f_dev_ino"), without opening the locked file: 
+ * the object is mapped read only and nothing is changed in it, so any process can inspect it.
+ * @param name shared memory object name
+ * @param buffer [out] struct rl_snapshot followed by as many entries as fit (malloc alignment)
+ * @param size size of buffer
+ * @return see rl_snapshot; −1 also in case of errors of shm_open, EPROTO - not a rl_lock_library object of this
+ * layout version, ENOENT - the object is being removed
+ */
+ssize_t rl_snapshot_shared(const char *name, void *buffer, size_t size);
 
 
 /**
- * Print internal structures
+ * Print internal structures, from a snapshot taken by rl_snapshot
  * @param lfd file descriptor
  */
 void rl_print(rl_descriptor lfd);
+
+
+/**
+ * Sets the runtime log level, messages above it are dropped without being formatted.
+ * Default level is RL_LOG_WARN, or the RL_LOG_LEVEL environment variable read by rl_init_library.
+ * Levels above RL_LOG_COMPILE_LEVEL (library build flag) are compiled out.
+ * @param level RL_LOG_NONE .. RL_LOG_DEBUG
+ */
+void rl_set_log_level(int level);
+
+/**
+ * Writes messages buffered by the process to stdout (info, debug) and stderr (errors, warnings).
+ * Library calls flush once the file mutex is released, it is also called at exit.
+ */
+void rl_log_flush();
@@ -1,17 +1,92 @@
 #include "rl_lock_library.h"
 #include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/futex.h>
+
+//static tracepoints of provider rl_lock, a probe is a nop until a tracer attaches to it:
+//  request(fd, type, start, len)          a lock or unlock request enters the slow path
+//  grant(type, start, len, isFast)        a lock is granted
+//  block(type, start, len, nbWaiters)     a request is queued to wait
+//  wakeup(type, start, len, waitedNs)     a waiting request is woken up
+//  release(start, len, holdNs)            a lock is released, holdNs is 0 unless hold times are measured
+//  merge(start, len)                      locks of an owner are joined into the region
+//  split(start, len, unlStart, unlLen)    a lock is cut by an unlock of part of its region
+//they are compiled out with RL_NO_PROBES or without sys/sdt.h
+#if !defined(RL_NO_PROBES) && defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define RL_HAS_PROBES
+    #endif
+#endif
+
+#if defined(RL_HAS_PROBES)
+    #define RL_PROBE2(Name, A1, A2)             DTRACE_PROBE2(rl_lock, Name, A1, A2)
+    #define RL_PROBE3(Name, A1, A2, A3)         DTRACE_PROBE3(rl_lock, Name, A1, A2, A3)
+    #define RL_PROBE4(Name, A1, A2, A3, A4)     DTRACE_PROBE4(rl_lock, Name, A1, A2, A3, A4)
+#else
+    #define RL_PROBE2(Name, A1, A2)             do { } while (0)
+    #define RL_PROBE3(Name, A1, A2, A3)         do { } while (0)
+    #define RL_PROBE4(Name, A1, A2, A3, A4)     do { } while (0)
+#endif
 
-#define NB_FILES            256
 #define NB_FD               512
 #define NEXT_NULL           -2
 #define NEXT_LAST           -1
 #define FILE_UNK            -1
 #define RES_ERR             -1
+#define OFFSET_MAX          ((off_t)INT64_MAX)
+
+#define RL_REGISTRY_SHARDS  16              /* power of 2, open files of the process are spread over shards */
+#define RL_REGISTRY_BUCKETS 16              /* initial buckets of a shard, doubled when entries outnumber them */
+
+#define RL_SNAPSHOT_RETRIES 64              /* snapshot reads before giving up with EAGAIN */
+#define RL_SNAPSHOT_DEPTH   128             /* interval index depth a snapshot read can walk */
+
+#define RL_LIVENESS_PERIOD  1               /* seconds a waiter sleeps before checking holders are alive */
+#define RL_DEADLOCK_DEPTH   32              /* wait-for edges followed from a request looking for a cycle */
+
+#define RL_WAIT_BLOCKING    0x1             /* wait_compatible: wait instead of failing with EAGAIN */
+#define RL_WAIT_PRIORITY    0x2             /* wait_compatible: queue ahead of the other waiters */
+
+#ifndef RL_LOG_COMPILE_LEVEL
+    #define RL_LOG_COMPILE_LEVEL RL_LOG_DEBUG   /* levels above are compiled out */
+#endif
+#define RL_LOG_RING_SIZE    256             /* power of 2 */
+#define RL_LOG_MSG_LEN      200
+
+#define RL_FAST_FREE        0
+#define RL_FAST_HELD        2
+#define RL_FAST_BUSY(pid)   (-(int)(pid))   /* slot changed by process pid */
+#define RL_FAST_SLOW        0x1u            /* locks are in the table, fast path is closed */
+#define RL_FAST_DRAINED     0x2u            /* fast slots are emptied by the mutex holder since the path is closed */
 
 #define SHARED_NAME_MAX_LEN 64
 #define SHARED_MEM_FORMAT   "/%c_%ld_%ld"
 #define SHARED_PREFIX_MEM 'f'
-#define SHARED_PREFIX_SEM 's'
+
+#define RL_STATE_CREATING   0               /* zero filled object, the creator initializes the header */
+#define RL_STATE_READY      1
+#define RL_STATE_DEAD       2               /* last reference is closed, the object is being unlinked */
+
+#define RL_INHERIT_FREE     0
+#define RL_INHERIT_BUSY     1               /* reserved by a forking parent, the child isn't known yet */
+#define RL_INHERIT_READY    2
+
+#define RL_IS_LINE_ALIGNED(Member) (0 == offsetof(rl_open_file, Member) % RL_CACHE_LINE)
+
+_Static_assert(offsetof(rl_open_file, magic) == 0, "magic must stay the first word of the shared object");
+_Static_assert(offsetof(rl_open_file, state) == 2 * sizeof(uint32_t), "state must follow the version header");
+_Static_assert(RL_IS_LINE_ALIGNED(mutex) && RL_IS_LINE_ALIGNED(seq) && RL_IS_LINE_ALIGNED(first_waiter)
+               && RL_IS_LINE_ALIGNED(refCnt) && RL_IS_LINE_ALIGNED(fast_state) && RL_IS_LINE_ALIGNED(nb_inherits)
+               && RL_IS_LINE_ALIGNED(stats) && RL_IS_LINE_ALIGNED(lock_pool),
+               "hot regions of rl_open_file must start a cache line");
+_Static_assert(sizeof(pthread_mutex_t) <= RL_CACHE_LINE, "file mutex must fit its cache line");
+_Static_assert(RL_IS_LINE_ALIGNED(holds), "hold histogram must not share the statistics cache line");
+_Static_assert(sizeof(rl_fast_lock) == RL_CACHE_LINE, "fast slots must not share cache lines");
+_Static_assert(RL_PAGE_SIZE % RL_CACHE_LINE == 0, "segments must keep the header alignment");
 
 //https://en.wikipedia.org/wiki/ANSI_escape_code#SGR_(Select_Graphic_Rendition)_parameters
 #define KNRM                "\x1B[0m\n"
@@ -25,44 +100,259 @@
 
 
 #if !defined(MIN)
-    #define MIN(x, y) x < y ? x: y
+    #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 #endif    
 
 #if !defined(MAX)
-    #define MAX(x, y) x > y ? x: y
+    #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #endif    
 
 /* ==================================== MACRO FUNCTIONS ============================================================= */
 
 #define CLOSE_FILE(File) if (File > 0) { close(File); File = -1; }
-#define KILL_SEMATHORE(Sem) if (Sem)  { sem_close(Sem); sem_destroy(Sem); }
-#define UNLINK_SEMATHORE(Name) if (Name) { sem_unlink(Name); }
 #define FREE_MMAP(Mem, len) if (Mem) { munmap(Mem, len); }
 #define FREE_MEM(Mem) if (Mem) { free(Mem); Mem = NULL; }
 
-#define PROC_ERROR(Message) { fprintf(stderr, "%s : error {%s} in file {%s} on line {%d}\n", Message, strerror(errno), __FILE__, __LINE__); }
+// arguments aren't evaluated when the level is disabled
+#define RL_LOG(Level, ...) do { if (((Level) <= RL_LOG_COMPILE_LEVEL) && ((Level) <= __atomic_load_n(&g_log.level, __ATOMIC_RELAXED))) { log_write(Level, __VA_ARGS__); } } while (0)
+#define RL_WARN(...)  RL_LOG(RL_LOG_WARN,  __VA_ARGS__)
+#define RL_INFO(...)  RL_LOG(RL_LOG_INFO,  __VA_ARGS__)
+#define RL_DEBUG(...) RL_LOG(RL_LOG_DEBUG, __VA_ARGS__)
+
+#define PROC_ERROR(Message) RL_LOG(RL_LOG_ERROR, "%s : error {%s} in file {%s} on line {%d}", Message, strerror(errno), __FILE__, __LINE__)
+
+#define LOCK_ERROR(Code) if (Code != 0) { RL_LOG(RL_LOG_ERROR, "%s : error {%s} in file {%s} on line {%d}", "mutex_lock() failure", strerror(Code), __FILE__, __LINE__); }
+#define UNLOCK_ERROR(Code) if (Code != 0) { RL_LOG(RL_LOG_ERROR, "%s : error {%s} in file {%s} on line {%d}", "mutex_unlock() failure", strerror(Code), __FILE__, __LINE__); }
+
+// log messages are formatted into a per-process ring and written out by rl_log_flush outside of the file mutex,
+// so a slow terminal or a full pipe never extends the time locks are held.
+typedef struct
+{
+    unsigned int    seq;        /* ticket + 1 once the message is published */
+    int             level;
+    char            msg[RL_LOG_MSG_LEN];
+} rl_log_entry;
+
+static struct
+{
+    int             level;      /* runtime level */
+    unsigned int    head;       /* next ticket to write */
+    unsigned int    tail;       /* next ticket to flush */
+    unsigned int    dropped;    /* messages lost because the ring was full */
+    int             flushing;   /* one flusher at a time */
+    rl_log_entry    entries[RL_LOG_RING_SIZE];
+} g_log = {.level = RL_LOG_WARN};
+
+/**
+ * format a message into the log ring, the message is dropped if the ring is full
+ * @param level message level
+ * @param format printf format
+ */
+static void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
 
-#define LOCK_ERROR(Code) if (Code != 0) { fprintf(stderr, "%s : error {%d} in file {%s} on line {%d}\n", "mutex_lock() failure", strerror(Code), __FILE__, __LINE__); }
-#define UNLOCK_ERROR(Code) if (Code != 0) { fprintf(stderr, "%s : error {%d} in file {%s} on line {%d}\n", "mutex_unlock() failure", strerror(Code), __FILE__, __LINE__); }
+/**
+ * drop messages of the parent, they are flushed by the parent
+ */
+static void log_reset_after_fork();
 
-static struct 
+// files opened by the process, keyed by (dev, ino). Each shard has its own mutex, so opening and closing
+// different files doesn't serialize threads.
+typedef struct rl_file_entry
+{
+    struct rl_file_entry   *next;
+    dev_t                   dev;
+    ino_t                   ino;
+    rl_open_file           *f;          /* mapping of the file */
+    int                     refs;       /* descriptors of the process using the file */
+} rl_file_entry;
+
+typedef struct
 {
-    int             nb_files;
-    rl_open_file   *tab_open_files[NB_FILES];
-    pthread_mutex_t mutex; //protect multi-threading access for library
-} rl_all_files;
+    pthread_mutex_t         mutex;
+    size_t                  nb_entries;
+    size_t                  nb_buckets; /* power of 2 */
+    rl_file_entry         **buckets;
+} rl_registry_shard;
+
+static rl_registry_shard g_registry[RL_REGISTRY_SHARDS];
 
 static bool  g_is_initialized = false;
+static pid_t g_pid            = 0;      // getpid() is a syscall, keep it for the hot path
+static __thread pid_t g_tid   = 0;
+static __thread bool  g_is_forking = false;  // rl_fork holds the registry, fork handlers leave it alone
+
+static inline pid_t current_pid()
+{
+    return (g_pid) ? g_pid : getpid();
+}
+
+static void refresh_pid()
+{
+    g_pid = getpid();
+    g_tid = 0;      //the child thread has its own id
+}
+
+static inline pid_t current_tid()
+{
+    if (!g_tid)
+    {
+        g_tid = (pid_t)syscall(SYS_gettid);
+    }
+    return g_tid;
+}
+
+static inline owner descriptor_owner(rl_descriptor lfd)
+{
+    owner own = {.proc = current_pid(), .des = lfd.d, .token = 0};
+    if (lfd.flags & RL_OWNER_THREAD)
+    {
+        own.token = (uint64_t)current_tid();
+    }
+    else if (lfd.flags & RL_OWNER_TOKEN)
+    {
+        own.token = lfd.token;
+    }
+    return own;
+}
+
+//==============================================================================================================
+// ranges: regions are half-open [start..end[ with 0 <= start <= end <= OFFSET_MAX, a region to the end of file ends 
+// at OFFSET_MAX. Once a request is normalized start + len can't overflow, so the tests below are plain comparisons 
+// joined with & to let the compiler drop the branches.
+
+static inline bool range_overlaps(off_t start1, off_t end1, off_t start2, off_t end2)
+{
+    return (start1 < end2) & (start2 < end1);
+}
+
+static inline bool range_touches(off_t start1, off_t end1, off_t start2, off_t end2)
+{
+    return (start1 <= end2) & (start2 <= end1);
+}
+
+static inline void range_merge(off_t *start, off_t *len, off_t start2, off_t len2)
+{
+    off_t end = MAX(*start + *len, start2 + len2);
+    *start    = MIN(*start, start2);
+    *len      = end - *start;
+}
+
+/* end of the region touching [start..end[ on the right, searches for neighbours use it */
+static inline off_t range_next(off_t end)
+{
+    return end + (end < OFFSET_MAX);
+}
+
+/* flock length of a region, 0 for a region to the end of file */
+static inline off_t range_flock_len(off_t start, off_t len)
+{
+    return (start + len == OFFSET_MAX) ? 0 : len;
+}
+
+//==============================================================================================================
+// statistics: counters are only added to, relaxed ordering is enough as nothing is synchronized through them
+
+static inline void stat_add(uint64_t *counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void stat_max(uint64_t *counter, uint64_t value)
+{
+    uint64_t current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while (    (current < value)
+            && (!__atomic_compare_exchange_n(counter, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+          );
+}
+
+static inline uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* acquisition time of a new lock, 0 - hold times aren't measured */
+static inline uint64_t hold_clock(rl_open_file *f)
+{
+    return (__atomic_load_n(&f->hold_tracking, __ATOMIC_RELAXED)) ? monotonic_ns() : 0;
+}
+
+/* earliest of two acquisition times, 0 is unknown */
+static inline uint64_t hold_min(uint64_t since1, uint64_t since2)
+{
+    return ((since1) && (since2)) ? MIN(since1, since2) : (since1 | since2);
+}
+
+static inline void *pool_slot(rl_open_file *f, rl_pool *pool, int index)
+{
+    int segment = pool->segments[index / pool->slots_per_segment];
+    return (char *)f + RL_HEADER_SIZE + (size_t)segment * RL_SEGMENT_SIZE
+                     + (size_t)(index % pool->slots_per_segment) * pool->slot_size;
+}
+
+// snapshot reads run concurrently with the mutex holder: indexes are checked against the pool before use, so
+// a torn read gives a wrong slot, never an address outside of the object
+static inline void *pool_slot_checked(rl_open_file *f, rl_pool *pool, int index)
+{
+    int slotsPerSegment = __atomic_load_n(&pool->slots_per_segment, __ATOMIC_RELAXED);
+    if (    (index < 0) 
+         || (slotsPerSegment <= 0) 
+         || (index >= __atomic_load_n(&pool->nb_slots, __ATOMIC_RELAXED)) 
+         || ((index / slotsPerSegment) >= RL_MAX_SEGMENTS)
+       )
+    {
+        return NULL;
+    }
+
+    int segment = __atomic_load_n(&pool->segments[index / slotsPerSegment], __ATOMIC_RELAXED);
+    if ((segment < 0) || (segment >= __atomic_load_n(&f->nb_segments, __ATOMIC_ACQUIRE)))
+    {
+        return NULL;
+    }
+    return (char *)f + RL_HEADER_SIZE + (size_t)segment * RL_SEGMENT_SIZE
+                     + (size_t)(index % slotsPerSegment) * pool->slot_size;
+}
+
+static inline rl_lock *lock_at(rl_open_file *f, int index)
+{
+    return pool_slot(f, &f->lock_pool, index);
+}
+
+static inline rl_owner *owner_at(rl_open_file *f, int index)
+{
+    return pool_slot(f, &f->owner_pool, index);
+}
+
+static inline rl_waiter *waiter_at(rl_open_file *f, int index)
+{
+    return pool_slot(f, &f->waiter_pool, index);
+}
+
+static inline rl_proc *proc_at(rl_open_file *f, int index)
+{
+    return pool_slot(f, &f->proc_pool, index);
+}
 
 /* ================================  AUXILIARY FUNCTIONS DEFINITIONS  =============================================== */
 
 /**
- * check ability to add new owner
+ * check that owner holds at least one lock
+ * @param own owner
+ * @param f file descriptor
+ * @return true if own holds a lock of f, false otherwise
+ */
+static bool has_locks(owner own, rl_open_file *f);
+
+/**
+ * check that the locks of an owner cover a whole region, whatever their type
  * @param own owner
  * @param f file descriptor
- * @return 1 si oui, 0 si own non dans table, -1 si capacité max
+ * @param start start of the region
+ * @param end end of the region (excluded)
+ * @return true if every byte of [start, end[ is locked by own, false otherwise
  */
-static int can_add_new_owner(owner own, rl_open_file *f);
+static bool has_region(owner own, rl_open_file *f, off_t start, off_t end);
 
 /**
  * add new owner
@@ -74,21 +364,136 @@ static int can_add_new_owner(owner own, rl_open_file *f);
 static int add_new_owner(owner own, owner new_owner, rl_open_file *f);
 
 /**
- * check ability to add new owner by pid
+ * add new owner by pid
  * @param parent parent pid
+ * @param parent child pid
  * @param f file descriptor
  * @return −1 in case of error, 0 - success
  */
-static int can_add_new_owner_by_pid(pid_t parent, rl_open_file *f);
+static int add_new_owner_by_pid(pid_t parent, pid_t fils, rl_open_file *f);
 
 /**
- * add new owner by pid
+ * reserve, without the file mutex, a record for a child about to inherit the read locks of parent; the fast path
+ * is closed and the parent's threads don't change the lock table until the record is completed
+ * @param f rl file descriptor
  * @param parent parent pid
- * @param parent child pid
- * @param f file descriptor
- * @return −1 in case of error, 0 - success
+ * @return true - reserved, false - no free record
  */
-static int add_new_owner_by_pid(pid_t parent, pid_t fils, rl_open_file *f);
+static bool reserve_inheritance(rl_open_file *f, pid_t parent);
+
+/**
+ * complete the record reserved by parent, it is resolved by the next mutex holder
+ * @param f rl file descriptor
+ * @param parent parent pid
+ * @param child child pid, −1 - the fork failed, the record is given back
+ */
+static void complete_inheritance(rl_open_file *f, pid_t parent, pid_t child);
+
+/**
+ * add the references of a child to the shared object of a registry entry, visitor used by rl_fork
+ * @param entry registry entry
+ * @param nb 1 - add the references of the entry, −1 - give them back
+ * @return true
+ */
+static bool fork_reference(rl_file_entry *entry, int nb);
+
+/**
+ * reserve an inheritance record if the parent holds read locks of the file, visitor used by rl_fork
+ * @param entry registry entry
+ * @param parent parent pid
+ * @return true - reserved or nothing to inherit, false - no free record
+ */
+static bool fork_reserve(rl_file_entry *entry, int parent);
+
+/**
+ * complete the inheritance record of the current process if there is one, visitor used by rl_fork
+ * @param entry registry entry
+ * @param child child pid, −1 - the record is given back
+ * @return true
+ */
+static bool fork_complete(rl_file_entry *entry, int child);
+
+/**
+ * inherit the read locks of recorded forks, called by the mutex holder before any change of the lock table;
+ * records still waiting for their child pid are left to a later holder
+ * @param f rl file descriptor
+ * @return true - the lock table may change, false - another thread of the process is forking, it has to wait
+ */
+static bool resolve_inheritances(rl_open_file *f);
+
+/**
+ * take a shared reference on an object unless its last reference is gone
+ * @param f rl file descriptor
+ * @return true - reference is taken, false - object is dead
+ */
+static bool ref_acquire(rl_open_file *f);
+
+/**
+ * add shared references to an object the caller holds a reference on
+ * @param f rl file descriptor
+ * @param nb number of references
+ */
+static void ref_add(rl_open_file *f, int nb);
+
+/**
+ * drop a shared reference, the last one marks the object dead: it has to be unlinked by the caller
+ * @param f rl file descriptor
+ * @return references left in all processes
+ */
+static int ref_release(rl_open_file *f);
+
+/**
+ * find the mapping of a file already open by the process and take a reference on it (local and shared)
+ * @param dev device of the file
+ * @param ino inode of the file
+ * @return mapping of the file, NULL if the process hasn't opened it
+ */
+static rl_open_file *registry_find(dev_t dev, ino_t ino);
+
+/**
+ * count a new descriptor of the process referencing an open file
+ * @param f rl file descriptor, identified by its dev & ino
+ * @return mapping registered for the file: f, or the mapping of another thread that registered it first; 
+ *         NULL in case of error
+ */
+static rl_open_file *registry_acquire(rl_open_file *f);
+
+/**
+ * forget a descriptor of the process referencing an open file (local and shared reference), 
+ * the file leaves the registry with the last descriptor of the process
+ * @param f rl file descriptor, identified by its dev & ino
+ * @param sharedRefs [out] references to the file left in all processes
+ * @return descriptors of the process still referencing the file, −1 if the file isn't registered
+ */
+static int registry_release(rl_open_file *f, int *sharedRefs);
+
+/**
+ * lock all shards of the registry, registered as fork prepare handler
+ */
+static void registry_lock_all();
+
+/**
+ * unlock all shards of the registry, registered as fork parent & child handler
+ */
+static void registry_unlock_all();
+
+/**
+ * call visit on each entry of the locked registry, until it returns false
+ * @param visit visitor
+ * @param arg argument of visit
+ * @return NULL - all entries visited, otherwise the file of the entry visit returned false for
+ */
+static rl_open_file *registry_visit(bool (*visit)(rl_file_entry *entry, int arg), int arg);
+
+/**
+ * fork prepare handler: lock the registry unless rl_fork already holds it
+ */
+static void fork_lock_registry();
+
+/**
+ * fork parent & child handler: unlock the registry unless rl_fork holds it
+ */
+static void fork_unlock_registry();
 
 /**
  * Initialize a mutex.
@@ -98,11 +503,30 @@ static int add_new_owner_by_pid(pid_t parent, pid_t fils, rl_open_file *f);
 static int init_mutex(pthread_mutex_t *pMutex);
 
 /**
- * Initialize a condition variable attributes object.
- * @param pCond pointer to condition
- * @return 0 if succesful, otherwise, an error number shall be returned to indicate the error
+ * Wait on a futex word while it holds val
+ * @param addr futex word in shared memory
+ * @param val expected value
+ * @param timeout relative timeout, NULL to wait forever
+ * @return 0 if woken up, -1 otherwise (errno is set)
+ */
+static int futex_wait(int *addr, int val, const struct timespec *timeout);
+
+/**
+ * Wait on a futex word while it holds val, until an absolute CLOCK_MONOTONIC time
+ * @param addr futex word in shared memory
+ * @param val expected value
+ * @param deadline absolute CLOCK_MONOTONIC time
+ * @return 0 if woken up, -1 otherwise (errno is set, ETIMEDOUT once deadline is passed)
+ */
+static int futex_wait_until(int *addr, int val, const struct timespec *deadline);
+
+/**
+ * Wake up processes waiting on a futex word
+ * @param addr futex word in shared memory
+ * @param nb maximum number of processes to wake up
+ * @return number of processes woken up, -1 in case of error
  */
-static int init_cond(pthread_cond_t *pCond);
+static int futex_wake(int *addr, int nb);
 
 /**
  * Test equality between two owners
@@ -113,24 +537,34 @@ static int init_cond(pthread_cond_t *pCond);
 static bool is_owners_are_equal(owner o1, owner o2);
 
 /**
- * Compose shared memory object name according format "/f_dev_ino", basing on file's stat information 
- * @param filePath [in] file path
- * @param type [in] shared object type: SHARED_PREFIX_MEM or SHARED_PREFIX_SEM
+ * Compose shared memory object name according format "/f_dev_ino"
+ * @param dev [in] device of the file
+ * @param ino [in] inode of the file
  * @param name [out] generated name
  * @param maxLen [in] maximum name length in characters
  * @return true - OK, false - error
  */
-static bool make_shared_name_by_path(const char *filePath, char type, char *name, size_t maxLen);
+static bool make_shared_name(dev_t dev, ino_t ino, char *name, size_t maxLen);
 
 /**
- * Compose shared memory object name according format "/f_dev_ino", basing on file's stat information 
- * @param fd [in] file descriptor
- * @param type [in] shared object type: SHARED_PREFIX_MEM or SHARED_PREFIX_SEM
- * @param name [out] generated name
- * @param maxLen [in] maximum name length in characters
- * @return true - OK, false - error
+ * Open or create the shared object of a file and take a reference on it. The creator is the process whose
+ * O_EXCL shm_open succeeds, others wait on the state word until the header is initialized, and retry if the
+ * object is being destroyed by its last user. An object its creator left unsized or uninitialized is marked dead
+ * and unlinked, the creator publishes the object with a CAS of the state word so it notices it was reclaimed.
+ * @param dev [in] device of the file
+ * @param ino [in] inode of the file
+ * @return mapping of the shared object, NULL in case of error
  */
-static bool make_shared_name_by_fd(int fd, char type, char *name, size_t maxLen);
+static rl_open_file *attach_shared_object(dev_t dev, ino_t ino);
+
+/**
+ * Wait for the creator to initialize a mapped shared object and take a reference on it
+ * @param f [in] mapping of the shared object
+ * @param name [in] shared object name
+ * @return 1 - reference is taken, 0 - object is dead, it has to be opened again, 
+ * −1 - object has another layout version (errno EPROTO)
+ */
+static int join_shared_object(rl_open_file *f, const char *name);
 
 /**
  * Get file size
@@ -145,10 +579,61 @@ static uint64_t get_file_size(int fd);
 static uint64_t get_current_position(int fd);
 
 /**
- * removes all locks if owners aren't alive
- * @param lfd [in] file descriptor
+ * check that a process is alive
+ * @param pid process id
+ * @return true - alive, false - dead
+ */
+static bool is_process_alive(pid_t pid);
+
+/**
+ * count a new lock owner of a process in the registry
+ * @param f rl file descriptor
+ * @param pid owner process
+ * @return −1 in case of error, 0 - success
+ */
+static int proc_acquire(rl_open_file *f, pid_t pid);
+
+/**
+ * forget a lock owner of a process, the process leaves the registry with its last owner
+ * @param f rl file descriptor
+ * @param pid owner process
+ */
+static void proc_release(rl_open_file *f, pid_t pid);
+
+/**
+ * removes locks and waiters of a dead process
+ * @param f rl file descriptor
+ * @param pid dead process
+ */
+static void reap_process(rl_open_file *f, pid_t pid);
+
+/**
+ * removes locks and waiters of all dead processes of the registry (one liveness check per process),
+ * used when the file mutex was left by a dead process
+ * @param f rl file descriptor
+ */
+static void reap_dead_processes(rl_open_file *f);
+
+/**
+ * removes locks and waiters of dead processes holding locks that conflict with a request,
+ * liveness is only checked when a request can't be granted
+ * @param f rl file descriptor
+ * @param own owner of the request
+ * @param lck request
+ * @return true - something was removed, false - otherwise
+ */
+static bool reap_conflicting_owners(rl_open_file *f, owner own, struct flock *lck);
+
+/**
+ * check whether waiting for a request would close a cycle in the wait-for graph: holders of the 
+ * conflicting locks waiting, directly or through other waiters, for a lock of the requester.
+ * Edges are the waiters queue against the lock table, so the graph is only walked when a request blocks
+ * @param f rl file descriptor
+ * @param own owner of the request
+ * @param lck request
+ * @return true - deadlock, false - otherwise
  */
-static void rl_clear_dead_owners(rl_descriptor lfd);
+static bool is_wait_cycle(rl_open_file *f, owner own, struct flock *lck);
 
 /**
  * delete lock by index
@@ -161,9 +646,10 @@ static void delete_lock(rl_open_file *f, int index);
  * delete owner
  * @param f rl file descriptor
  * @param index lock index
- * @param d file descriptor
+ * @param own owner
+ * @param isAllTokens true - every owner of own.des in the process, whatever its token
  */
-static void delete_owner(rl_open_file *f, int index, int d);
+static void delete_owner(rl_open_file *f, int index, owner own, bool isAllTokens);
 
 /**
  * delete lock region
@@ -190,1251 +676,4121 @@ static int add_write_lock_region(rl_descriptor lfd, struct flock *lck);
 static int add_read_lock_region(rl_descriptor lfd, struct flock *lck);
 
 /**
- * add new lock
+ * remove part of a region from a lock of an owner: a lock held by the owner alone is trimmed in place,
+ * a hole adds a lock for the right piece only
  * @param f rl file descriptor
- * @param lck lock descriptor
- * @param d file descriptor
- * @param type lock type
+ * @param index lock index
+ * @param own lock owner
+ * @param since acquisition time of the owner, kept by the pieces
+ * @param unlStart start of the removed region
+ * @param unlEnd end of the removed region (excluded), the region doesn't cover the whole lock
  * @return −1 in case of error, 0 - success
  */
-static int add_lock(rl_open_file *f, struct flock *lck, int d, int type);
+static int cut_lock(rl_open_file *f, int index, owner own, uint64_t since, off_t unlStart, off_t unlEnd);
 
 /**
- * add new lock owner
+ * change the type of the locks of lfd on a region, in place if a single lock of lfd alone covers exactly the region,
+ * the region must be held by lfd
  * @param lfd rl descriptor
- * @param lck lock descriptor
+ * @param cmd F_SETLK or F_SETLKW
+ * @param lck region
+ * @param type new lock type: F_RDLCK or F_WRLCK
  * @return −1 in case of error, 0 - success
  */
-static int add_owner(rl_descriptor lfd, rl_lock *lck);
+static int change_lock_type(rl_descriptor lfd, int cmd, struct flock *lck, short type);
 
 /**
- * check new lock and current locks compatibility
+ * lock, unlock or test a region, common part of rl_fcntl and rl_fcntl_timed
  * @param lfd rl descriptor
- * @param lck new lock descriptor
- * @return true - compatible, false - otherwise
+ * @param cmd F_SETLK, F_SETLKW or F_GETLK
+ * @param lck request
+ * @param deadline absolute CLOCK_MONOTONIC time of a F_SETLKW request, NULL to wait forever
+ * @return −1 in case of error, 0 - success
  */
-static bool is_rl_compatible(rl_descriptor lfd, struct flock *lck);
+static int fcntl_request(rl_descriptor lfd, int cmd, struct flock *lck, const struct timespec *deadline);
 
 /**
- * check if lock has other owners than d
- * @param d file descriptor
- * @param lck lock descriptor
- * @return true - it has, false - it hasn't
+ * convert a request to an absolute region: SEEK_SET whence, positive length, l_len 0 ends at OFFSET_MAX
+ * @param lfd rl descriptor
+ * @param lck [in, out] request
+ * @return −1 in case of error (errno EINVAL - region starts before the file, EOVERFLOW - region ends after OFFSET_MAX),
+ * 0 - success
  */
-static bool is_other_owner(int d, rl_lock *lck);
+static int normalize_request(rl_descriptor lfd, struct flock *lck);
 
 /**
- * check that lock has owner
- * @param d file descriptor
- * @param lck lock descriptor
- * @return true - it has, false - it hasn't
+ * apply a compatible request to the lock table and wake up waiters it may satisfy
+ * @param lfd rl descriptor
+ * @param lck request: F_RDLCK, F_WRLCK or F_UNLCK
+ * @return −1 in case of error, 0 - success
  */
-static bool is_owner(int d, rl_lock *lck);
+static int apply_request(rl_descriptor lfd, struct flock *lck);
 
 /**
- * check that regions are matching
- * @param offset region offset
- * @param len region len
- * @param lck lock descriptor
- * @return true - equal, false - not
+ * grow the pools so that a set of requests can be applied without allocation failure: a lock request takes at most
+ * one lock and one owner, an unlock cuts each lock of the owner crossing one of its bounds into a new piece
+ * @param f rl file descriptor
+ * @param own owner of the requests
+ * @param lcks requests
+ * @param nb number of requests
+ * @return −1 in case of error, 0 - success
  */
-static bool is_region_equal(off_t offset, off_t len, rl_lock *lck);
+static int reserve_requests(rl_open_file *f, owner own, struct flock *lcks, size_t nb);
 
 /**
- * check that region has intersections or neighbours 
- * @param offset region offset
- * @param len region len
- * @param lck lock descriptor
- * @return true - there is(are), false - not
+ * find a request of a set that conflicts with locks of other owners or has to wait behind queued waiters
+ * @param f rl file descriptor
+ * @param own owner of the requests
+ * @param waiterIdx waiter of the requests, NEXT_NULL if they aren't queued
+ * @param lcks requests
+ * @param nb number of requests
+ * @return index of the first conflicting request, −1 if all of them can be granted
  */
-static bool is_region_intersection_or_neighbour(off_t offset, off_t len, rl_lock *lck);
+static int find_conflicting_request(rl_open_file *f, owner own, int waiterIdx, struct flock *lcks, size_t nb);
 
 /**
- * check that region has intersections
- * @param offset region offset
- * @param len region len
- * @param lck lock descriptor
- * @return true - there is(are), false - not
+ * wait until a set of requests can be granted, the file mutex is held on entry and on return
+ * @param f rl file descriptor
+ * @param own owner of the requests
+ * @param lcks requests
+ * @param nb number of requests
+ * @param flags RL_WAIT_BLOCKING (without it, fail with EAGAIN instead of waiting), RL_WAIT_PRIORITY
+ * @param deadline absolute CLOCK_MONOTONIC time after which waiting fails with ETIMEDOUT, NULL - no limit
+ * @return −1 in case of error, 0 - all requests are compatible
  */
-static bool is_region_intersection(off_t offset, off_t len, rl_lock *lck);
+static int wait_compatible(rl_open_file *f, owner own, struct flock *lcks, size_t nb, int flags, 
+                           const struct timespec *deadline);
 
 /**
- * check that region has intersections
- * @param l lock
- * @param o owner
- * @return true - lock has owner, false - otherwise
+ * collect locks of other owners conflicting with a request, safe without the file mutex
+ * @param f rl file descriptor
+ * @param own owner of the request
+ * @param lck request
+ * @param conflicts [out] conflicting locks
+ * @param max capacity of conflicts
+ * @return number of conflicting locks written, −1 if the table was seen inconsistent
  */
-bool has_owner(rl_lock *l, owner *o);
+static int collect_conflicts(rl_open_file *f, owner own, const struct flock *lck, struct flock *conflicts, size_t max);
 
+/**
+ * collect conflicting locks from a consistent snapshot of the lock table: the read is validated by f->seq, 
+ * the file mutex is never taken
+ * @param f rl file descriptor
+ * @param own owner of the request
+ * @param lck request
+ * @param conflicts [out] conflicting locks
+ * @param max capacity of conflicts
+ * @return number of conflicting locks written, −1 if writers kept changing the table (errno EAGAIN)
+ */
+static int snapshot_conflicts(rl_open_file *f, owner own, const struct flock *lck, struct flock *conflicts, size_t max);
 
-///////////////////////////////////         RL_LIBRARY FUNCTIONS       /////////////////////////////////////////////////
-//////////                                                                                                      ////////
+/**
+ * check, without the file mutex, whether a process holds read locks of a file
+ * @param f rl file descriptor
+ * @param pid owner process
+ * @return true - pid holds read locks, or writers keep changing the table; false - none
+ */
+static bool has_read_locks(rl_open_file *f, pid_t pid);
+
+/**
+ * read the statistics counters of a file
+ * @param f rl file descriptor
+ * @param stats [out] counters, fast path acquisitions included
+ */
+static void load_stats(rl_open_file *f, struct rl_stats *stats);
+
+/**
+ * read the header fields and entries of a snapshot, without validating them
+ * @param f rl file descriptor
+ * @param head [out] snapshot header
+ * @param entries [out] entries
+ * @param max capacity of entries
+ * @return number of entries found (only max are written), −1 if the tables were seen inconsistent
+ */
+static ssize_t collect_snapshot(rl_open_file *f, struct rl_snapshot *head, rl_snapshot_entry *entries, size_t max);
+
+/**
+ * take a snapshot validated by f->seq, see rl_snapshot
+ * @param f rl file descriptor
+ * @param buffer [out] snapshot
+ * @param size size of buffer
+ * @return size of the whole snapshot, −1 in case of error
+ */
+static ssize_t snapshot_file(rl_open_file *f, void *buffer, size_t size);
+
+/**
+ * add new lock
+ * @param f rl file descriptor
+ * @param lck lock descriptor
+ * @param own lock owner
+ * @param type lock type
+ * @param since acquisition time, see hold_clock
+ * @return −1 in case of error, 0 - success
+ */
+static int add_lock(rl_open_file *f, struct flock *lck, owner own, int type, uint64_t since);
+
+/**
+ * acquisition time of the entry of an owner in a lock
+ * @param f rl file descriptor
+ * @param l lock
+ * @param own lock owner
+ * @return acquisition time, 0 if it isn't known
+ */
+static uint64_t owner_since(rl_open_file *f, rl_lock *l, owner own);
+
+/**
+ * account the releases of the entries of a descriptor in a lock, whatever their token, before it is closed
+ * @param f rl file descriptor
+ * @param index lock index
+ * @param own owner of the descriptor
+ */
+static void note_close_releases(rl_open_file *f, int index, owner own);
+
+/**
+ * account a released lock: fires the release probe and adds the hold time to the histogram if it is known
+ * @param f rl file descriptor
+ * @param since acquisition time, 0 if it isn't known
+ * @param start released region offset
+ * @param len released region len
+ */
+static void note_release(rl_open_file *f, uint64_t since, off_t start, off_t len);
+
+/**
+ * take the file mutex: locks held in fast slots are moved to the lock table and the fast path is closed
+ * until the table is empty again
+ * @param f rl file descriptor
+ */
+static void rl_lock_file(rl_open_file *f);
+
+/**
+ * move the locks of fast slots to the lock table once the fast path is closed, slots busy with a change are
+ * waited for, or given back if the process changing them died
+ * @param f rl file descriptor, the mutex is held
+ */
+static void drain_fast_locks(rl_open_file *f);
+
+/**
+ * check whether fast slots hold locks of a process
+ * @param f rl file descriptor
+ * @param pid owner process
+ * @return true - a fast slot is held by pid, false - none
+ */
+static bool has_fast_locks(rl_open_file *f, pid_t pid);
+
+/**
+ * release the file mutex, the fast path is reopened if there is no lock in the table, nobody waits
+ * and no fork is inheriting
+ * @param f rl file descriptor
+ */
+static void rl_unlock_file(rl_open_file *f);
+
+/**
+ * take a read lock in a fast slot with atomic operations only, possible while the lock table is empty
+ * and the owner has no other fast lock touching the region
+ * @param f rl file descriptor
+ * @param own lock owner
+ * @param start region offset
+ * @param len region len
+ * @return true - lock is taken, false - slow path has to be used
+ */
+static bool fast_read_lock(rl_open_file *f, owner own, off_t start, off_t len);
+
+/**
+ * find a fast lock of the owner touching the region
+ * @param f rl file descriptor
+ * @param own lock owner
+ * @param start region offset
+ * @param len region len
+ * @param except fast slot left out, −1 - none
+ * @return true - found, false - none
+ */
+static bool is_fast_touching(rl_open_file *f, owner own, off_t start, off_t len, int except);
+
+/**
+ * release a read lock held in a fast slot
+ * @param f rl file descriptor
+ * @param own lock owner
+ * @param start region offset
+ * @param len region len
+ * @return true - lock is released, false - no fast slot matches, slow path has to be used
+ */
+static bool fast_unlock(rl_open_file *f, owner own, off_t start, off_t len);
+
+/**
+ * add new lock owner
+ * @param lfd rl descriptor
+ * @param lck lock descriptor
+ * @return −1 in case of error, 0 - success
+ */
+static int add_owner(rl_descriptor lfd, rl_lock *lck);
+
+/**
+ * check new lock of any owner and current locks compatibility
+ * @param f rl file descriptor
+ * @param own owner of the new lock
+ * @param type new lock type
+ * @param start new lock region offset
+ * @param len new lock region len
+ * @return true - compatible, false - otherwise
+ */
+static bool is_compatible(rl_open_file *f, owner own, short type, off_t start, off_t len);
+
+/**
+ * check whether the fairness policy of the file makes a request wait behind queued waiters
+ * @param f rl file descriptor
+ * @param own owner of the request
+ * @param waiterIdx waiter of the request, NEXT_NULL if it isn't queued
+ * @param type request lock type
+ * @param start request region offset
+ * @param len request region len
+ * @return true - request has to wait, false - otherwise
+ */
+static bool is_queued_behind(rl_open_file *f, owner own, int waiterIdx, short type, off_t start, off_t len);
+
+/**
+ * check if lock has other owners than o
+ * @param f rl file descriptor
+ * @param o owner
+ * @param lck lock descriptor
+ * @return true - it has, false - it hasn't
+ */
+static bool is_other_owner(rl_open_file *f, owner *o, rl_lock *lck);
+
+/**
+ * check that lock has the owner of a descriptor
+ * @param lfd rl descriptor
+ * @param lck lock descriptor
+ * @return true - it has, false - it hasn't
+ */
+static bool is_owner(rl_descriptor lfd, rl_lock *lck);
+
+/**
+ * check that regions are matching
+ * @param offset region offset
+ * @param len region len
+ * @param lck lock descriptor
+ * @return true - equal, false - not
+ */
+static bool is_region_equal(off_t offset, off_t len, rl_lock *lck);
+
+/**
+ * check that region has intersections
+ * @param offset region offset
+ * @param len region len
+ * @param lck lock descriptor
+ * @return true - there is(are), false - not
+ */
+static bool is_region_intersection(off_t offset, off_t len, rl_lock *lck);
+
+/**
+ * end of the region of a lock
+ * @param lck lock descriptor
+ * @return offset following the last byte of the lock
+ */
+static off_t lock_end(rl_lock *lck);
+
+/**
+ * check that lock has owner
+ * @param f rl file descriptor
+ * @param l lock
+ * @param o owner
+ * @return true - lock has owner, false - otherwise
+ */
+static bool has_owner(rl_open_file *f, rl_lock *l, owner *o);
+
+/**
+ * add owner to the owners of lock
+ * @param f rl file descriptor
+ * @param l lock
+ * @param o owner
+ * @param since acquisition time, see hold_clock
+ * @return −1 in case of error, 0 - success
+ */
+static int push_owner(rl_open_file *f, rl_lock *l, owner o, uint64_t since);
+
+/**
+ * register the current F_SETLKW request in the waiters list
+ * @param f rl file descriptor
+ * @param own owner of the request
+ * @param lck request
+ * @param isFirst true - ahead of the other waiters, false - at the end of the list
+ * @return waiter index, −1 in case of error
+ */
+static int add_waiter(rl_open_file *f, owner own, struct flock *lck, bool isFirst);
+
+/**
+ * remove a waiter from the waiters list
+ * @param f rl file descriptor
+ * @param index waiter index
+ */
+static void delete_waiter(rl_open_file *f, int index);
+
+/**
+ * wake up the waiters whose request intersects freed region and can now be granted,
+ * a waiter isn't woken up if it conflicts with a waiter woken up before it
+ * @param f rl file descriptor
+ * @param start freed region offset
+ * @param end freed region end (excluded)
+ */
+static void wake_waiters(rl_open_file *f, off_t start, off_t end);
+
+/**
+ * prepare an empty pool
+ * @param pool pool
+ * @param slotSize size of pooled structure
+ */
+static void pool_init(rl_pool *pool, int slotSize);
+
+/**
+ * take a slot from the pool, growing the shared object if the pool is empty
+ * @param f rl file descriptor
+ * @param pool pool of f
+ * @return slot index, −1 in case of error
+ */
+static int pool_alloc(rl_open_file *f, rl_pool *pool);
+
+/**
+ * give a slot back to the pool
+ * @param f rl file descriptor
+ * @param pool pool of f
+ * @param index slot index
+ */
+static void pool_free(rl_open_file *f, rl_pool *pool, int index);
+
+/**
+ * extend the shared object by one arena segment (ftruncate), segment is visible to other processes without remapping
+ * because every process reserves RL_MAP_SIZE
+ * @param f rl file descriptor
+ * @return arena segment number, −1 in case of error
+ */
+static int grow_shared_object(rl_open_file *f);
+
+/**
+ * add a segment of free slots to the pool
+ * @param f rl file descriptor
+ * @param pool pool of f
+ * @return −1 in case of error, 0 - success
+ */
+static int pool_grow(rl_open_file *f, rl_pool *pool);
+
+/**
+ * grow the pool until it has nb free slots, so that the next nb allocations can't fail
+ * @param f rl file descriptor
+ * @param pool pool of f
+ * @param nb number of free slots
+ * @return −1 in case of error, 0 - success
+ */
+static int pool_reserve(rl_open_file *f, rl_pool *pool, int nb);
+
+/**
+ * filter applied to locks found in the interval index
+ * @param f rl file descriptor
+ * @param index lock index
+ * @param ctx filter context
+ * @return true - lock is accepted, false - continue search
+ */
+typedef bool (*lock_filter)(rl_open_file *f, int index, void *ctx);
+
+/**
+ * context of the interval index filters
+ */
+typedef struct
+{
+    owner           own;        /* requester */
+    short           type;       /* requested lock type */
+    off_t           start;      /* requested region offset */
+    off_t           len;        /* requested region len */
+} lock_filter_ctx;
+
+/**
+ * context of the deadlock detection filter
+ */
+typedef struct
+{
+    lock_filter_ctx req;        /* region waited for by req.own */
+    owner           origin;     /* requester about to block */
+    int             depth;      /* wait-for edges followed from origin */
+} wait_cycle_ctx;
+
+/**
+ * lock filter accepting the lock of type req->type covering exactly the requested region, held by req->own alone
+ * @param f rl file descriptor
+ * @param index lock index
+ * @param ctx lock_filter_ctx
+ * @return true - lock is accepted, false - continue search
+ */
+static bool filter_sole_owned(rl_open_file *f, int index, void *ctx);
+
+/**
+ * lock filter accepting the locks held by req->own
+ * @param f rl file descriptor
+ * @param index lock index
+ * @param ctx lock_filter_ctx
+ * @return true - lock is accepted, false - continue search
+ */
+static bool filter_owned(rl_open_file *f, int index, void *ctx);
+
+/**
+ * insert lock into the interval index and into the offset ordered list
+ * @param f rl file descriptor
+ * @param index lock index
+ */
+static void index_insert(rl_open_file *f, int index);
+
+/**
+ * remove lock from the interval index and from the offset ordered list
+ * @param f rl file descriptor
+ * @param index lock index
+ */
+static void index_remove(rl_open_file *f, int index);
+
+/**
+ * change the region of a lock in place, the slot and its owners are kept; the lock only moves in the index
+ * if it goes past one of its neighbours
+ * @param f rl file descriptor
+ * @param index lock index
+ * @param start new region start
+ * @param len new region len
+ */
+static void index_reshape(rl_open_file *f, int index, off_t start, off_t len);
+
+/**
+ * lock a region for an owner, joining the locks of the owner accepted by filter that intersect or touch it:
+ * the first one the owner holds alone is extended in place instead of allocating a new lock
+ * @param f rl file descriptor
+ * @param lck [in, out] region, the joined region on return
+ * @param own lock owner
+ * @param type lock type
+ * @param filter locks of the owner to join, called with a lock_filter_ctx of the region
+ * @param since acquisition time of the region, the earliest one of the joined locks is kept
+ * @return −1 in case of error, 0 - success
+ */
+static int join_owned_locks(rl_open_file *f, struct flock *lck, owner own, short type, lock_filter filter, uint64_t since);
+
+/**
+ * find the first lock (in offset order) intersecting region [start..end[ and accepted by filter,
+ * complexity is O(log n + k), where k is the number of intersecting locks rejected by filter
+ * @param f rl file descriptor
+ * @param start region start
+ * @param end region end (excluded)
+ * @param filter lock filter
+ * @param ctx filter context
+ * @return lock index, NEXT_NULL if not found
+ */
+static int index_find(rl_open_file *f, off_t start, off_t end, lock_filter filter, void *ctx);
+
+
+///////////////////////////////////         RL_LIBRARY FUNCTIONS       /////////////////////////////////////////////////
+//////////                                                                                                      ////////
+
+int rl_init_library() {
+    if (g_is_initialized)
+    {
+        return 0;
+    }
+
+    int code = -1;    
+    for (int i = 0; i < RL_REGISTRY_SHARDS; i++)
+    {
+        if ((code = pthread_mutex_init(&g_registry[i].mutex, NULL)) != 0)
+        {
+            PROC_ERROR(strerror(code));
+            return code;
+        }
+        g_registry[i].nb_entries = 0;
+        g_registry[i].nb_buckets = 0;
+        g_registry[i].buckets    = NULL;
+    }
+
+    const char *logLevel = getenv("RL_LOG_LEVEL");
+    if (logLevel)
+    {
+        rl_set_log_level(atoi(logLevel));
+    }
+
+    refresh_pid();
+    if (    ((code = pthread_atfork(NULL, NULL, refresh_pid)) != 0)
+         || ((code = pthread_atfork(NULL, NULL, log_reset_after_fork)) != 0)
+         || ((code = pthread_atfork(fork_lock_registry, fork_unlock_registry, fork_unlock_registry)) != 0)
+       )
+    {
+        PROC_ERROR(strerror(code));
+        return code;
+    }
+    atexit(rl_log_flush);
+
+    g_is_initialized = true;
+
+    return code;
+}
+
+
+rl_descriptor rl_open(const char *path, int oflag, ...)
+{    
+    va_list        parameters;
+    mode_t         mode                   = -1;
+    int            fdFile                 = -1;
+    rl_open_file*  pRlOpenFile            = NULL;
+    rl_descriptor  stRlDescriptor         = {.d = -1, .f = NULL};
+    
+    // ======================================== get arguments ==========================================================
+    
+    if (oflag & O_CREAT)
+    {
+        va_start(parameters, oflag);
+        mode = (mode_t)va_arg(parameters, int);
+        va_end(parameters);
+    }
+
+    //first open the file, if we can't - everything else is useless 
+    fdFile = open(path, oflag, mode);
+    if (fdFile < 0)
+    {
+        PROC_ERROR("open() file failure");
+        goto lExit;
+    }
+
+    struct stat statBuffer;
+    if (0 > fstat(fdFile, &statBuffer))
+    {
+        PROC_ERROR("fstat() failure");
+        CLOSE_FILE(fdFile);
+        goto lExit;  
+    }
+
+    //the process has the file open already: share its mapping
+    pRlOpenFile = registry_find(statBuffer.st_dev, statBuffer.st_ino);
+    if (pRlOpenFile)
+    {
+        RL_DEBUG("Open: mapping reused, RC : %d", pRlOpenFile->refCnt);
+        goto lExit;
+    }
+
+    // =================== open or create shared memory object =========================================================
+    pRlOpenFile = attach_shared_object(statBuffer.st_dev, statBuffer.st_ino);
+    if (!pRlOpenFile)
+    {
+        CLOSE_FILE(fdFile);
+        goto lExit;  
+    }
+
+    // ============================== register new rl_open_file in the process registry ===============================
+    rl_open_file *pRegistered = registry_acquire(pRlOpenFile);
+    if (!pRegistered)
+    {
+        //drop the reference of this mapping, the object goes with it if nobody else joined
+        char pSharedMemName[SHARED_NAME_MAX_LEN];
+        if (    (0 == ref_release(pRlOpenFile)) 
+             && (make_shared_name(pRlOpenFile->dev, pRlOpenFile->ino, pSharedMemName, SHARED_NAME_MAX_LEN))
+           )
+        {
+            shm_unlink(pSharedMemName);
+        }
+        FREE_MMAP(pRlOpenFile, RL_MAP_SIZE);
+
+        PROC_ERROR("registry_acquire() failure");
+        CLOSE_FILE(fdFile);
+        pRlOpenFile = NULL;
+        goto lExit;  
+    }
+    if (pRegistered != pRlOpenFile)
+    {
+        //another thread has mapped the same object meanwhile: the shared reference taken here is the one of this 
+        //descriptor, only the duplicate mapping goes
+        FREE_MMAP(pRlOpenFile, RL_MAP_SIZE);
+        pRlOpenFile = pRegistered;
+    }
+    RL_DEBUG("Open: RC : %d", pRlOpenFile->refCnt);
+
+lExit:
+    rl_log_flush();
+
+    stRlDescriptor.d = (pRlOpenFile) ? fdFile : FILE_UNK;
+    stRlDescriptor.f = pRlOpenFile;    
+    return stRlDescriptor;
+}
+
+static rl_open_file *attach_shared_object(dev_t dev, ino_t ino)
+{
+    char          pSharedMemName[SHARED_NAME_MAX_LEN];
+    rl_open_file *f              = NULL;
+    int           fdSharedMemory = -1;
+
+    if (!make_shared_name(dev, ino, pSharedMemName, SHARED_NAME_MAX_LEN))
+    {
+        return NULL;
+    }
+    RL_DEBUG("shared name %s", pSharedMemName);
+
+    for (;;)
+    {
+        bool isNewFile = true;
+
+        fdSharedMemory = shm_open(pSharedMemName, 
+                                  O_CREAT | O_RDWR | O_EXCL,  
+                                  S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+        if (0 > fdSharedMemory)
+        {
+            if (errno != EEXIST)
+            {
+                PROC_ERROR("shm_open() failure");
+                return NULL;
+            }
+
+            isNewFile = false;
+            fdSharedMemory = shm_open(pSharedMemName, O_RDWR, 0);
+            if (0 > fdSharedMemory)
+            {
+                if (errno == ENOENT)
+                {
+                    continue; //unlinked by its last user meanwhile
+                }
+                PROC_ERROR("shm_open() failure");
+                return NULL;
+            }
+        }
+        RL_DEBUG("%s shared file %s!", (isNewFile) ? "new" : "existing", pSharedMemName);
+
+        if ((isNewFile) && (0 > ftruncate(fdSharedMemory, RL_HEADER_SIZE)))
+        {
+            PROC_ERROR("ftruncate() failure");
+            CLOSE_FILE(fdSharedMemory);
+            shm_unlink(pSharedMemName);
+            return NULL;
+        }
+
+        //the creator sizes the object right after creating it, the header mustn't be touched before
+        struct stat statBuffer = {.st_size = 0};
+        bool        isOrphan   = false;
+        for (int i = 0; (!isNewFile) && (i < RL_LIVENESS_PERIOD * 1000); i++)
+        {
+            if ((0 > fstat(fdSharedMemory, &statBuffer)) || (statBuffer.st_size >= (off_t)RL_HEADER_SIZE))
+            {
+                break;
+            }
+            usleep(1000);
+        }
+        if ((!isNewFile) && (statBuffer.st_size < (off_t)RL_HEADER_SIZE))
+        {
+            //the creator died before sizing it: size the header to mark the object dead, a creator merely late 
+            //sizes it to the same length and fails to publish it
+            if (0 > ftruncate(fdSharedMemory, RL_HEADER_SIZE))
+            {
+                PROC_ERROR("ftruncate() failure");
+                CLOSE_FILE(fdSharedMemory);
+                return NULL;
+            }
+            isOrphan = true;
+        }
+
+        // map object to memory
+        // reserve room for all segments, pages beyond the object size are only touched once it has grown
+        f = mmap(0, RL_MAP_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fdSharedMemory, 0);
+        CLOSE_FILE(fdSharedMemory);
+        if (MAP_FAILED == (void *)f)
+        {
+            PROC_ERROR("mmap() failure");
+            if (isNewFile)
+            {
+                shm_unlink(pSharedMemName);
+            }
+            return NULL;
+        }
+
+        if (isNewFile) 
+        {
+            //the object is zero filled by ftruncate, state is RL_STATE_CREATING and a joiner may already mark it dead
+            __atomic_store_n(&f->creator, current_pid(), __ATOMIC_RELEASE);
+            f->magic   = RL_MAGIC;
+            f->version = RL_LAYOUT_VERSION;
+            f->dev     = dev;
+            f->ino     = ino;
+            init_mutex(&f->mutex);
+
+            f->first_waiter = NEXT_NULL;
+            f->last_waiter  = NEXT_NULL;
+            f->blockCnt     = 0;
+            f->policy       = RL_POLICY_READERS;
+
+            f->first = NEXT_NULL;
+            f->root  = NEXT_NULL;
+            f->seed  = (unsigned int)current_pid() | 1u;
+            pool_init(&f->lock_pool,  sizeof(rl_lock));
+            pool_init(&f->owner_pool, sizeof(rl_owner));
+            pool_init(&f->waiter_pool, sizeof(rl_waiter));
+            pool_init(&f->proc_pool,   sizeof(rl_proc));
+            f->first_proc = NEXT_NULL;
+            f->refCnt     = 1;
+
+            int creating = RL_STATE_CREATING;
+            if (__atomic_compare_exchange_n(&f->state, &creating, RL_STATE_READY, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                futex_wake(&f->state, INT_MAX);
+                return f;
+            }
+
+            //a joiner gave up on this process and unlinked the object, a new one will be created
+            RL_WARN("%s was reclaimed before it was ready", pSharedMemName);
+            FREE_MMAP(f, RL_MAP_SIZE);
+            continue;
+        }
+
+        int creating = RL_STATE_CREATING;
+        if (    (isOrphan) 
+             && (__atomic_compare_exchange_n(&f->state, &creating, RL_STATE_DEAD, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+           )
+        {
+            RL_WARN("creator of %s died before sizing it", pSharedMemName);
+            shm_unlink(pSharedMemName);
+        }
+
+        int joined = join_shared_object(f, pSharedMemName);
+        if (joined > 0)
+        {
+            return f;
+        }
+        if (joined < 0)
+        {
+            FREE_MMAP(f, RL_MAP_SIZE);
+            return NULL;
+        }
+
+        //its last user is unlinking it, a new object will be created
+        FREE_MMAP(f, RL_MAP_SIZE);
+        sched_yield();
+    }
+}
+
+static int join_shared_object(rl_open_file *f, const char *name)
+{
+    int state;
+    while (RL_STATE_CREATING == (state = __atomic_load_n(&f->state, __ATOMIC_ACQUIRE)))
+    {
+        struct timespec period  = {.tv_sec = RL_LIVENESS_PERIOD, .tv_nsec = 0};
+        pid_t           creator = 0;
+        if (    (0 > futex_wait(&f->state, RL_STATE_CREATING, &period)) 
+             && (errno == ETIMEDOUT)
+             && ((0 == (creator = __atomic_load_n(&f->creator, __ATOMIC_ACQUIRE))) || (!is_process_alive(creator)))
+           )
+        {
+            //the creator died before the object was ready, or before storing its pid a liveness period ago: 
+            //the first to notice destroys it
+            int creating = RL_STATE_CREATING;
+            if (__atomic_compare_exchange_n(&f->state, &creating, RL_STATE_DEAD, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                RL_WARN("creator %d of %s died", creator, name);
+                shm_unlink(name);
+            }
+        }
+    }
+
+    if (state == RL_STATE_DEAD)
+    {
+        return 0;
+    }
+
+    //the mutex of another layout can't be trusted, a library built differently uses the file
+    if ((f->magic != RL_MAGIC) || (f->version != RL_LAYOUT_VERSION))
+    {
+        RL_LOG(RL_LOG_ERROR, "%s has layout %#x:%u, expected %#x:%u", name, f->magic, f->version, RL_MAGIC, RL_LAYOUT_VERSION);
+        errno = EPROTO;
+        return -1;
+    }
+
+    return ref_acquire(f) ? 1 : 0;
+}
+
+static bool ref_acquire(rl_open_file *f)
+{
+    //a count seen at 0 never grows again: the releaser of the last reference unlinks the object
+    int refs = __atomic_load_n(&f->refCnt, __ATOMIC_ACQUIRE);
+    do
+    {
+        if (refs <= 0)
+        {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&f->refCnt, &refs, refs + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return true;
+}
+
+static void ref_add(rl_open_file *f, int nb)
+{
+    __atomic_fetch_add(&f->refCnt, nb, __ATOMIC_RELAXED);
+}
+
+static int ref_release(rl_open_file *f)
+{
+    //release: changes made with the reference are seen by whoever tears the object down
+    int refs = __atomic_sub_fetch(&f->refCnt, 1, __ATOMIC_ACQ_REL);
+    if (refs <= 0)
+    {
+        __atomic_store_n(&f->state, RL_STATE_DEAD, __ATOMIC_RELEASE);
+    }
+    return refs;
+}
+
+int rl_close(rl_descriptor lfd)
+{
+    char    pSharedMemName[SHARED_NAME_MAX_LEN];
+    int     rc             = -1;
+    int     localRefs      = -1;
+    int     lockIdx        = NEXT_NULL;
+
+    if ((lfd.d == FILE_UNK) || (!lfd.f))
+    {
+        PROC_ERROR("wrong input");
+        return RES_ERR;
+    }
+
+    rl_lock_file(lfd.f);
+
+    RL_DEBUG("looking through locks...");
+    lockIdx = lfd.f->first;
+    while (lockIdx >= 0)
+    {
+        int nextLock = lock_at(lfd.f, lockIdx)->next_lock;
+        note_close_releases(lfd.f, lockIdx, descriptor_owner(lfd));
+        delete_owner(lfd.f, lockIdx, descriptor_owner(lfd), true);
+        lockIdx = nextLock;
+    }
+    wake_waiters(lfd.f, 0, OFFSET_MAX);
+
+    rl_unlock_file(lfd.f);
+
+    //the last reference marks the object dead, openers seeing it create a new one once it is unlinked
+    localRefs = registry_release(lfd.f, &rc);
+    RL_DEBUG("Close: RC : %d!", rc);
+
+    CLOSE_FILE(lfd.d);
+
+    if (rc <= 0)
+    {
+        RL_DEBUG("last ref!");
+
+        if (lfd.f->first >= 0)
+        {
+            PROC_ERROR("Last reference deleted, but file locks aren't deleted!");
+        }
+
+        //the mutex isn't destroyed: an opener may still take it to find out the object is dead
+        if (make_shared_name(lfd.f->dev, lfd.f->ino, pSharedMemName, SHARED_NAME_MAX_LEN))
+        {
+            shm_unlink(pSharedMemName);
+        }
+    }
+
+    //the mapping is shared by all descriptors of the process on the file
+    if (localRefs == 0)
+    {
+        FREE_MMAP(lfd.f, RL_MAP_SIZE);
+    }
+
+    rl_log_flush();
+    return rc;
+}
+//==============================================================================================================
+
+rl_descriptor rl_dup(rl_descriptor lfd){
+    rl_descriptor ret       = {.d = -1, .f = NULL, .flags = lfd.flags, .token = lfd.token};
+    owner         own       = descriptor_owner(lfd);
+    owner         new_owner = own;
+
+    if ((lfd.d == FILE_UNK) || (!lfd.f))
+    {
+        PROC_ERROR("wrong input");
+        return ret;
+    }
+
+    rl_lock_file(lfd.f);
+
+    //the copy keeps the ownership mode, and so the locks, of lfd
+    new_owner.des = dup(lfd.d);
+    if(new_owner.des == -1) 
+    {
+        PROC_ERROR("dup() failure"); // no close of newd (ref man dup)
+        goto lExit;
+    }
+
+    if ((has_locks(own, lfd.f)) && (0 != add_new_owner(own, new_owner, lfd.f)))
+    {
+        PROC_ERROR("rl_dup() failure, can't share locks");
+        close(new_owner.des);
+        goto lExit;
+    }
+
+    ret.d = new_owner.des;
+    ret.f = lfd.f;
+    ref_add(lfd.f, 1);
+    
+    RL_DEBUG("Dup: RC : %d Fd:%d", lfd.f->refCnt, new_owner.des);
+
+lExit:    
+    rl_unlock_file(lfd.f);
+
+    //the file is registered by lfd, so only its count changes (registry is locked before the file, never after)
+    if (ret.f)
+    {
+        registry_acquire(ret.f);
+    }
+    rl_log_flush();
+
+    return ret;
+}
+
+
+rl_descriptor rl_dup2(rl_descriptor lfd, int newd) {
+    rl_descriptor ret       = {.d = -1, .f = NULL, .flags = lfd.flags, .token = lfd.token};
+    owner         own       = descriptor_owner(lfd);
+    owner         new_owner = own;
+    
+    if ((lfd.d == FILE_UNK) || (!lfd.f))
+    {
+        PROC_ERROR("wrong input");
+        return ret;
+    }
+
+    new_owner.des = newd;
+    rl_lock_file(lfd.f);
+
+    if(dup2(lfd.d, newd) == -1) 
+    {
+        PROC_ERROR("dup() failure"); // no close of newd (ref man dup)
+        goto lExit;
+    }
+
+    if ((has_locks(own, lfd.f)) && (0 != add_new_owner(own, new_owner, lfd.f)))
+    {
+        PROC_ERROR("rl_dup2() failure, can't share locks");
+        close(newd);
+        goto lExit;
+    }
+
+    ret.d = new_owner.des;
+    ret.f = lfd.f;
+    ref_add(lfd.f, 1);
+
+    RL_DEBUG("Dup2: RC : %d", lfd.f->refCnt);
+
+lExit:    
+    rl_unlock_file(lfd.f);
+
+    if (ret.f)
+    {
+        registry_acquire(ret.f);
+    }
+    rl_log_flush();
+
+    return ret;
+}
+
+pid_t rl_fork() 
+{
+    pid_t         pid;
+    rl_open_file *full;
+
+    //the child drops messages inherited from the parent
+    rl_log_flush();
+
+    //the child's references and inheritance are taken before the fork: it may close its descriptors before the parent
+    //runs again, and until the record names it no release of the parent can take the locks away from it.
+    //The registry stays locked, so no file is opened or closed meanwhile
+    registry_lock_all();
+    g_is_forking = true;
+    registry_visit(fork_reference, 1);
+    while (NULL != (full = registry_visit(fork_reserve, current_pid())))
+    {
+        //the mutex holder frees resolved records, no reservation is kept meanwhile so no one waits for this fork
+        registry_visit(fork_complete, -1);
+        rl_lock_file(full);
+        rl_unlock_file(full);
+    }
+
+    pid = fork();
+    if (0 != pid)
+    {
+        //the parent names the child without waiting for it, records are resolved by the next mutex holder
+        registry_visit(fork_complete, pid);
+    }
+    if (-1 == pid)
+    {
+        registry_visit(fork_reference, -1);
+    }
+
+    g_is_forking = false;
+    registry_unlock_all();
+    rl_log_flush();
+    return pid;
+}
+
+
+int rl_fcntl(rl_descriptor lfd, int cmd, struct flock *lck)
+{
+    return fcntl_request(lfd, cmd, lck, NULL);
+}
+
+int rl_fcntl_timed(rl_descriptor lfd, int cmd, struct flock *lck, const struct timespec *abs_deadline)
+{
+    //a deadline out of range would fail every futex wait, and the wait would spin until the clock passes it
+    if (    ((F_SETLK != cmd) && (F_SETLKW != cmd))
+         || ((abs_deadline) && ((abs_deadline->tv_nsec < 0) || (abs_deadline->tv_nsec >= 1000 * 1000 * 1000)))
+       )
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    return fcntl_request(lfd, cmd, lck, abs_deadline);
+}
+
+static int fcntl_request(rl_descriptor lfd, int cmd, struct flock *lck, const struct timespec *deadline)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f) || (!lck) || ((F_SETLK != cmd) && (F_SETLKW != cmd) && (F_GETLK != cmd)))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct flock lc    = *lck;
+    int          ret   = 0;
+    int          flags = (F_SETLKW == cmd) ? RL_WAIT_BLOCKING : 0;
+
+    if (0 != normalize_request(lfd, &lc))
+    {
+        return -1;
+    }
+
+    owner own = descriptor_owner(lfd);
+
+    if (F_GETLK == cmd)
+    {
+        if ((lc.l_type != F_RDLCK) && (lc.l_type != F_WRLCK))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        int nb = snapshot_conflicts(lfd.f, own, &lc, lck, 1);
+        if (0 == nb)
+        {
+            lck->l_type = F_UNLCK;
+        }
+        return (nb < 0) ? -1 : 0;
+    }
+    if (    ((lc.l_type == F_RDLCK) && (fast_read_lock(lfd.f, own, lc.l_start, lc.l_len)))
+         || ((lc.l_type == F_UNLCK) && (fast_unlock(lfd.f, own, lc.l_start, lc.l_len)))
+       )
+    {
+        return 0;
+    }
+
+    RL_PROBE4(request, lfd.d, lc.l_type, lc.l_start, lc.l_len);
+    rl_lock_file(lfd.f);
+
+    if (    (lc.l_type != F_UNLCK)
+         && (0 != wait_compatible(lfd.f, own, &lc, 1, flags, deadline))
+       )
+    {
+        ret = -1;
+        goto lExit;
+    }
+
+    ret = apply_request(lfd, &lc);
+
+lExit:    
+    rl_unlock_file(lfd.f);
+    rl_log_flush();
+
+    return ret;
+}
+
+int rl_query_conflicts(rl_descriptor lfd, const struct flock *lck, struct flock *conflicts, size_t max)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f) || (!lck) || ((!conflicts) && (max)))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct flock lc  = *lck;
+    owner        own = descriptor_owner(lfd);
+
+    if ((lc.l_type != F_RDLCK) && (lc.l_type != F_WRLCK))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (0 != normalize_request(lfd, &lc))
+    {
+        return -1;
+    }
+
+    return snapshot_conflicts(lfd.f, own, &lc, conflicts, max);
+}
+
+static int compare_requests(const void *a, const void *b)
+{
+    const struct flock *lckA = a;
+    const struct flock *lckB = b;
+
+    //unlocks, then read locks, then write locks
+    int rankA = (lckA->l_type == F_UNLCK) ? 0 : (lckA->l_type == F_RDLCK) ? 1 : 2;
+    int rankB = (lckB->l_type == F_UNLCK) ? 0 : (lckB->l_type == F_RDLCK) ? 1 : 2;
+    if (rankA != rankB)
+    {
+        return rankA - rankB;
+    }
+    return (lckA->l_start > lckB->l_start) - (lckA->l_start < lckB->l_start);
+}
+
+int rl_fcntl_batch(rl_descriptor lfd, int cmd, const struct flock *locks, size_t n)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f) || ((F_SETLK != cmd) && (F_SETLKW != cmd)) || ((!locks) && (n)))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!n)
+    {
+        return 0;
+    }
+
+    int           ret  = 0;
+    size_t        nb   = 0;
+    owner         own  = descriptor_owner(lfd);
+    struct flock *lcks = malloc(n * sizeof(struct flock));
+    if (!lcks)
+    {
+        PROC_ERROR("malloc() failure");
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((locks[i].l_type != F_RDLCK) && (locks[i].l_type != F_WRLCK) && (locks[i].l_type != F_UNLCK))
+        {
+            PROC_ERROR("wrong lock type");
+            free(lcks);
+            errno = EINVAL;
+            return -1;
+        }
+
+        lcks[i] = locks[i];
+        if (0 != normalize_request(lfd, &lcks[i]))
+        {
+            free(lcks);
+            return -1;
+        }
+    }
+
+    //coalesce overlapping and adjacent regions of the same type
+    qsort(lcks, n, sizeof(struct flock), compare_requests);
+    for (size_t i = 0; i < n; i++)
+    {
+        struct flock *last = (nb) ? &lcks[nb - 1] : NULL;
+        if ((last) && (last->l_type == lcks[i].l_type) &&
+            (range_touches(last->l_start, last->l_start + last->l_len, lcks[i].l_start, lcks[i].l_start + lcks[i].l_len)))
+        {
+            range_merge(&last->l_start, &last->l_len, lcks[i].l_start, lcks[i].l_len);
+        }
+        else
+        {
+            lcks[nb++] = lcks[i];
+        }
+    }
+
+    rl_lock_file(lfd.f);
+
+    if (0 != wait_compatible(lfd.f, own, lcks, nb, (F_SETLKW == cmd) ? RL_WAIT_BLOCKING : 0, NULL))
+    {
+        ret = -1;
+        goto lExit;
+    }
+
+    //all or nothing: once the pools hold the slots the set may take, no request can fail
+    if (0 != reserve_requests(lfd.f, own, lcks, nb))
+    {
+        ret = -1;
+        goto lExit;
+    }
+
+    for (size_t i = 0; i < nb; i++)
+    {
+        if (0 != apply_request(lfd, &lcks[i]))
+        {
+            PROC_ERROR("request of a reserved set failed");
+            ret = -1;
+        }
+    }
+
+lExit:    
+    rl_unlock_file(lfd.f);
+    rl_log_flush();
+    free(lcks);
+
+    return ret;
+}
+
+int rl_set_policy(rl_descriptor lfd, int policy)
+{
+    if (    (lfd.d == FILE_UNK) || (!lfd.f)
+         || ((policy != RL_POLICY_READERS) && (policy != RL_POLICY_WRITERS) && (policy != RL_POLICY_FIFO))
+       )
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    rl_lock_file(lfd.f);
+    lfd.f->policy = policy;
+    //waiters held back by the previous policy may be granted now
+    wake_waiters(lfd.f, 0, OFFSET_MAX);
+    rl_unlock_file(lfd.f);
+    rl_log_flush();
+
+    return 0;
+}
+
+int rl_upgrade(rl_descriptor lfd, int cmd, struct flock *lck)
+{
+    return change_lock_type(lfd, cmd, lck, F_WRLCK);
+}
+
+int rl_downgrade(rl_descriptor lfd, struct flock *lck)
+{
+    return change_lock_type(lfd, F_SETLK, lck, F_RDLCK);
+}
+
+int rl_stats(rl_descriptor lfd, struct rl_stats *stats)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f) || (!stats))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    load_stats(lfd.f, stats);
+    return 0;
+}
+
+int rl_set_hold_histogram(rl_descriptor lfd, bool enable)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    //locks taken before are released without a known acquisition time, they aren't counted
+    __atomic_store_n(&lfd.f->hold_tracking, (enable) ? 1 : 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int rl_hold_histogram(rl_descriptor lfd, struct rl_holds *holds)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f) || (!holds))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (int i = 0; i < RL_HOLD_SIZES; i++)
+    {
+        for (int j = 0; j < RL_HOLD_TIMES; j++)
+        {
+            holds->counts[i][j] = __atomic_load_n(&lfd.f->holds.counts[i][j], __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+ssize_t rl_snapshot(rl_descriptor lfd, void *buffer, size_t size)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f) || ((!buffer) && (size)))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    return snapshot_file(lfd.f, buffer, size);
+}
+
+ssize_t rl_snapshot_shared(const char *name, void *buffer, size_t size)
+{
+    if ((!name) || ((!buffer) && (size)))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fdSharedMemory = shm_open(name, O_RDONLY, 0);
+    if (0 > fdSharedMemory)
+    {
+        return -1;
+    }
+
+    //an object still being sized by its creator has nothing to show yet
+    struct stat statBuffer;
+    if ((0 > fstat(fdSharedMemory, &statBuffer)) || (statBuffer.st_size < (off_t)RL_HEADER_SIZE))
+    {
+        CLOSE_FILE(fdSharedMemory);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    //pages of segments added later become readable as soon as the object grows
+    rl_open_file *f = mmap(0, RL_MAP_SIZE, PROT_READ, MAP_SHARED, fdSharedMemory, 0);
+    CLOSE_FILE(fdSharedMemory);
+    if (MAP_FAILED == (void *)f)
+    {
+        return -1;
+    }
+
+    ssize_t ret   = -1;
+    int     state = __atomic_load_n(&f->state, __ATOMIC_ACQUIRE);
+    if ((f->magic != RL_MAGIC) || (f->version != RL_LAYOUT_VERSION))
+    {
+        errno = EPROTO;
+    }
+    else if (state != RL_STATE_READY)
+    {
+        errno = (state == RL_STATE_DEAD) ? ENOENT : EAGAIN;
+    }
+    else
+    {
+        ret = snapshot_file(f, buffer, size);
+    }
+
+    FREE_MMAP(f, RL_MAP_SIZE);
+    return ret;
+}
+
+static int change_lock_type(rl_descriptor lfd, int cmd, struct flock *lck, short type)
+{
+    if ((lfd.d == FILE_UNK) || (!lfd.f) || (!lck) || ((cmd != F_SETLK) && (cmd != F_SETLKW)))
+    {
+        PROC_ERROR("wrong input");
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct flock lc  = *lck;
+    int          ret = 0;
+    lc.l_type = type;
+    if (0 != normalize_request(lfd, &lc))
+    {
+        return -1;
+    }
+
+    owner own = descriptor_owner(lfd);
+
+    rl_lock_file(lfd.f);
+
+    //changing the type of a region that isn't held would lock it from scratch
+    if (!has_region(own, lfd.f, lc.l_start, lc.l_start + lc.l_len))
+    {
+        errno = ENOLCK;
+        ret   = -1;
+        goto lExit;
+    }
+
+    //an upgrade waits for the other readers ahead of queued requests, they would wait for it anyway
+    if (0 != wait_compatible(lfd.f, own, &lc, 1, ((F_SETLKW == cmd) ? RL_WAIT_BLOCKING : 0) | RL_WAIT_PRIORITY, NULL))
+    {
+        ret = -1;
+        goto lExit;
+    }
+
+    lock_filter_ctx req     = {.own = own, .type = (type == F_WRLCK) ? F_RDLCK : F_WRLCK, .start = lc.l_start, .len = lc.l_len};
+    int             lockIdx = index_find(lfd.f, lc.l_start, lc.l_start + lc.l_len, filter_sole_owned, &req);
+    if (lockIdx >= 0)
+    {
+        lock_at(lfd.f, lockIdx)->type = type;
+        stat_add(&lfd.f->stats.acquisitions, 1);
+        RL_PROBE4(grant, type, lc.l_start, lc.l_len, 0);
+        if (type == F_RDLCK)
+        {
+            wake_waiters(lfd.f, lc.l_start, lc.l_start + lc.l_len);
+        }
+    }
+    else
+    {
+        ret = apply_request(lfd, &lc);
+    }
+
+lExit:    
+    rl_unlock_file(lfd.f);
+    rl_log_flush();
+
+    return ret;
+}
+
+static int normalize_request(rl_descriptor lfd, struct flock *lck)
+{
+    off_t base  = 0;
+    off_t start = 0;
+    off_t end   = OFFSET_MAX;
+
+    //align start & len to make common way
+    if      (lck->l_whence == SEEK_CUR) { base = (off_t)get_current_position(lfd.d); }
+    else if (lck->l_whence == SEEK_END) { base = (off_t)get_file_size(lfd.d);        }
+    else if (lck->l_whence != SEEK_SET) { errno = EINVAL; return -1;                 }
+
+    if (__builtin_add_overflow(base, lck->l_start, &start))
+    {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    if (lck->l_len > 0)
+    {
+        if (__builtin_add_overflow(start, lck->l_len, &end))
+        {
+            errno = EOVERFLOW;
+            return -1;
+        }
+    }
+    else if (lck->l_len < 0)
+    {
+        //[start + len..start[, a negative start is refused below and can't be moved further down
+        end    = start;
+        start += (start >= 0) ? lck->l_len : 0;
+    }
+    if ((start < 0) || (start >= end))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    lck->l_start  = start;
+    lck->l_len    = end - start;
+    lck->l_pid    = current_pid();
+    lck->l_whence = SEEK_SET; 
+    return 0;
+}
+
+static int apply_request(rl_descriptor lfd, struct flock *lck)
+{
+    int ret = 0;
+
+    if (lck->l_type == F_UNLCK)
+    {
+        ret = delete_lock_region(lfd, lck);
+
+        //unblock only waiters of the released region
+        wake_waiters(lfd.f, lck->l_start, lck->l_start + lck->l_len);
+    }
+    else if (lck->l_type == F_RDLCK)
+    {
+        ret = add_read_lock_region(lfd, lck);
+
+        //a write lock of the same owner may have been turned to read
+        wake_waiters(lfd.f, lck->l_start, lck->l_start + lck->l_len);
+    }
+    else if (lck->l_type == F_WRLCK)
+    {
+        ret = add_write_lock_region(lfd, lck);
+    }
+
+    if ((0 == ret) && (lck->l_type != F_UNLCK))
+    {
+        stat_add(&lfd.f->stats.acquisitions, 1);
+        RL_PROBE4(grant, lck->l_type, lck->l_start, lck->l_len, 0);
+    }
+
+    return ret;
+}
+
+static int find_conflicting_request(rl_open_file *f, owner own, int waiterIdx, struct flock *lcks, size_t nb)
+{
+    for (size_t i = 0; i < nb; i++)
+    {
+        if (    (lcks[i].l_type != F_UNLCK)
+             && (    (!is_compatible(f, own, lcks[i].l_type, lcks[i].l_start, lcks[i].l_len))
+                  || (is_queued_behind(f, own, waiterIdx, lcks[i].l_type, lcks[i].l_start, lcks[i].l_len))
+                )
+           )
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static bool is_time_before(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec) || ((a->tv_sec == b->tv_sec) && (a->tv_nsec < b->tv_nsec));
+}
+
+static int wait_compatible(rl_open_file *f, owner own, struct flock *lcks, size_t nb, int flags, 
+                           const struct timespec *deadline)
+{
+    int      ret       = 0;
+    int      waiterIdx = NEXT_NULL;
+    bool     isWakeup  = false;
+    uint64_t waitStart = 0;
+    int      conflict;
+
+    while ((conflict = find_conflicting_request(f, own, waiterIdx, lcks, nb)) >= 0)
+    {
+        stat_add(&f->stats.conflicts, 1);
+        if (isWakeup)
+        {
+            stat_add(&f->stats.spurious_wakeups, 1);
+            isWakeup = false;
+        }
+
+        if (reap_conflicting_owners(f, own, &lcks[conflict]))
+        {
+            continue;
+        }
+
+        if (!(flags & RL_WAIT_BLOCKING))
+        {
+            RL_DEBUG("Lock isn't compatible");
+            errno = EAGAIN;
+            ret   = -1;
+            break;
+        }
+
+        //the request closing a cycle fails, the others of the cycle keep waiting
+        if (is_wait_cycle(f, own, &lcks[conflict]))
+        {
+            RL_DEBUG("Deadlock detected");
+            errno = EDEADLK;
+            ret   = -1;
+            break;
+        }
+
+        if (waiterIdx < 0)
+        {
+            if ((waiterIdx = add_waiter(f, own, &lcks[conflict], (flags & RL_WAIT_PRIORITY))) < 0)
+            {
+                ret = -1;
+                break;
+            }
+            stat_add(&f->stats.waits, 1);
+            waitStart = monotonic_ns();
+            RL_PROBE4(block, lcks[conflict].l_type, lcks[conflict].l_start, lcks[conflict].l_len, f->blockCnt);
+        }
+        else
+        {
+            //a set waits on its first conflicting region, keeping its place in the queue
+            waiter_at(f, waiterIdx)->type  = lcks[conflict].l_type;
+            waiter_at(f, waiterIdx)->start = lcks[conflict].l_start;
+            waiter_at(f, waiterIdx)->len   = lcks[conflict].l_len;
+        }
+
+        //holders may die without releasing, so liveness is checked again after RL_LIVENESS_PERIOD
+        struct timespec wakeTime;
+        clock_gettime(CLOCK_MONOTONIC, &wakeTime);
+        if ((deadline) && (!is_time_before(&wakeTime, deadline)))
+        {
+            RL_DEBUG("Lock wait timed out");
+            errno = ETIMEDOUT;
+            ret   = -1;
+            break;
+        }
+        wakeTime.tv_sec += RL_LIVENESS_PERIOD;
+        if ((deadline) && (is_time_before(deadline, &wakeTime)))
+        {
+            wakeTime = *deadline;
+        }
+
+        RL_DEBUG("!!!BLOCKED!!!");
+        waiter_at(f, waiterIdx)->wake = 0;
+        rl_unlock_file(f);
+        bool isTimeout = (0 != futex_wait_until(&waiter_at(f, waiterIdx)->wake, 0, &wakeTime)) && (errno == ETIMEDOUT);
+        rl_lock_file(f);
+
+        //a timed out wait only rechecks the holders, finding them alive isn't a spurious wakeup
+        if (isTimeout)
+        {
+            stat_add(&f->stats.timeouts, 1);
+        }
+        else
+        {
+            stat_add(&f->stats.wakeups, 1);
+            isWakeup = true;
+        }
+        RL_PROBE4(wakeup, lcks[conflict].l_type, lcks[conflict].l_start, lcks[conflict].l_len, monotonic_ns() - waitStart);
+    }
+
+    if (waiterIdx >= 0)
+    {
+        RL_DEBUG("!!!UNBLOCKED!!!");
+
+        uint64_t waited = monotonic_ns() - waitStart;
+        stat_add(&f->stats.wait_ns, waited);
+        stat_max(&f->stats.max_wait_ns, waited);
+
+        //a waiter giving up may have been woken up or be ahead in the queue, waiters it was holding back are reconsidered
+        bool isWoken = waiter_at(f, waiterIdx)->wake;
+        off_t start  = waiter_at(f, waiterIdx)->start;
+        off_t len    = waiter_at(f, waiterIdx)->len;
+        delete_waiter(f, waiterIdx);
+        if ((ret != 0) && ((isWoken) || (f->policy != RL_POLICY_READERS)))
+        {
+            wake_waiters(f, start, start + len);
+        }
+    }
+
+    return ret;
+}
+
+void rl_print(rl_descriptor lfd)
+{
+    if ((lfd.d == -1) || (!lfd.f))
+    {
+        PROC_ERROR("wrong input");
+        return;
+    }
+
+    struct rl_snapshot *snap = NULL;
+    size_t              size = sizeof(struct rl_snapshot) + RL_FAST_SLOTS * sizeof(rl_snapshot_entry);
+    ssize_t             len;
+
+    //the table may grow between two attempts
+    for (;;)
+    {
+        struct rl_snapshot *larger = realloc(snap, size);
+        if (!larger)
+        {
+            PROC_ERROR("realloc() failure");
+            free(snap);
+            return;
+        }
+        snap = larger;
+
+        if (    (0 <= (len = rl_snapshot(lfd, snap, size)))
+             || (errno != EAGAIN)
+           )
+        {
+            if ((len < 0) || ((size_t)len <= size))
+            {
+                break;
+            }
+            size = (size_t)len;
+        }
+    }
+    if (len < 0)
+    {
+        PROC_ERROR("rl_snapshot() failure");
+        free(snap);
+        return;
+    }
+
+    printf(KRED "> RL d:%d, references %d" KNRM, lfd.d, snap->refs);
+    for (size_t i = 0; i < snap->nb_entries; i++)
+    {
+        rl_snapshot_entry *e = &snap->entries[i];
+        printf("%s > %s [%ld..%ld%s], %s, owner %d:%d:%llu" KNRM, 
+               (e->kind == RL_SNAPSHOT_WAITER) ? KYEL : KGRN,
+               (e->kind == RL_SNAPSHOT_LOCK) ? "Lock" : (e->kind == RL_SNAPSHOT_FAST) ? "Fast lock" : "Waiter",
+               e->start, 
+               (e->len) ? e->start + e->len - 1 : OFFSET_MAX,
+               (e->len) ? "" : " EOF",
+               (e->type == F_RDLCK) ? "RD" : "WR",
+               e->des, e->pid, (unsigned long long)e->token);
+    }
+    printf(KNRM);
+    free(snap);
+}
+
+////////////////////////////////////         AUXILIARY FONCTIONS       /////////////////////////////////////////////////
+//////////                                                                                                      ////////
+
+static int init_mutex(pthread_mutex_t *pMutex)
+{
+    pthread_mutexattr_t mutexAttr;
+    int code = pthread_mutexattr_init(&mutexAttr);
+    if (code != 0)
+    {
+        return code;
+    }
+    code = pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+    if (code != 0)
+    {
+        return code;
+    }
+    code = pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+    if (code != 0)
+    {
+        return code;
+    }
+    code = pthread_mutex_init(pMutex, &mutexAttr);
+    return code;
+}
+
+
+static int futex_wait(int *addr, int val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static int futex_wait_until(int *addr, int val, const struct timespec *deadline)
+{
+    //FUTEX_WAIT_BITSET takes an absolute timeout, measured against CLOCK_MONOTONIC
+    return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+
+static int futex_wake(int *addr, int nb)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, nb, NULL, NULL, 0);
+}
+
+
+static bool make_shared_name(dev_t dev, ino_t ino, char *name, size_t maxLen)
+{        
+    if (!name)
+    {
+        PROC_ERROR("wrong arguments");
+        return false;
+    }
+
+    int len = snprintf(name, maxLen, SHARED_MEM_FORMAT, SHARED_PREFIX_MEM, (long)dev, (long)ino);
+    if ((0 > len) || ((size_t)len >= maxLen))
+    {
+        PROC_ERROR("name formatting error! not enough space?");
+        return false;
+    }
+    return true;
+}
+
+static bool is_owners_are_equal(owner o1, owner o2){
+    return ((o1.des == o2.des) && (o1.proc == o2.proc) && (o1.token == o2.token));
+}
+
+
+static bool has_locks(owner own, rl_open_file *f)
+{
+    for (int ind = f->first; ind >= 0; ind = lock_at(f, ind)->next_lock)
+    {
+        if (has_owner(f, lock_at(f, ind), &own))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_region(owner own, rl_open_file *f, off_t start, off_t end)
+{
+    //locks are ordered by start offset, so the covered prefix only grows along the list
+    for (int ind = f->first; (ind >= 0) && (start < end); ind = lock_at(f, ind)->next_lock)
+    {
+        rl_lock *lck = lock_at(f, ind);
+        if (lck->starting_offset > start)
+        {
+            break;
+        }
+        if ((lock_end(lck) > start) && (has_owner(f, lck, &own)))
+        {
+            start = lock_end(lck);
+        }
+    }
+    return start >= end;
+}
+
+static bool has_owner(rl_open_file *f, rl_lock *l, owner *o)
+{
+    for (int ownIdx = l->owners; ownIdx >= 0; ownIdx = owner_at(f, ownIdx)->next)
+    {
+        if (is_owners_are_equal(owner_at(f, ownIdx)->own, *o))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int push_owner(rl_open_file *f, rl_lock *l, owner o, uint64_t since)
+{
+    int ownIdx = pool_alloc(f, &f->owner_pool);
+    if (ownIdx < 0)
+    {
+        return -1;
+    }
+    if (0 != proc_acquire(f, o.proc))
+    {
+        pool_free(f, &f->owner_pool, ownIdx);
+        return -1;
+    }
+
+    owner_at(f, ownIdx)->own   = o;
+    owner_at(f, ownIdx)->since = since;
+    owner_at(f, ownIdx)->next  = l->owners;
+    l->owners = ownIdx;
+    l->nb_owners ++;
+    return 0;
+}
+
+
+
+static int add_new_owner(owner own, owner new_owner, rl_open_file *f)
+{
+    //ind can be NEXT_NULL(-2) or NEXT_LAST(-1)
+    for (int ind = f->first; ind >= 0; ind = lock_at(f, ind)->next_lock)
+    {
+        rl_lock *lck = lock_at(f, ind);
+        if (    (lck->type == F_RDLCK)
+             && (has_owner(f, lck, &own))
+             && (!has_owner(f, lck, &new_owner))
+           )
+        {
+            if (0 != push_owner(f, lck, new_owner, hold_clock(f)))
+            {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+static int add_new_owner_by_pid(pid_t parent, pid_t fils, rl_open_file *f){
+    int res = 0;
+    for (int ind = f->first; ind >= 0; ind = lock_at(f, ind)->next_lock)
+    {
+        rl_lock *lck = lock_at(f, ind);
+        if (lck->type != F_RDLCK)
+        {
+            continue;
+        }
+
+        //new owners are pushed in front, so the walk only meets owners present before the fork
+        for (int ownIdx = lck->owners; ownIdx >= 0; ownIdx = owner_at(f, ownIdx)->next)
+        {
+            if (owner_at(f, ownIdx)->own.proc == parent)
+            {
+                owner new_owner = owner_at(f, ownIdx)->own;
+                new_owner.proc  = fils;
+
+                if ((!has_owner(f, lck, &new_owner)) && (0 != push_owner(f, lck, new_owner, hold_clock(f))))
+                {
+                    PROC_ERROR("add_new_owner_by_pid() failure");
+                    res = -1;
+                }
+            }
+        }
+    }
+    return res;
+}
+
+static bool reserve_inheritance(rl_open_file *f, pid_t parent)
+{
+    __atomic_fetch_add(&f->nb_inherits, 1, __ATOMIC_ACQ_REL);
+    for (int i = 0; i < RL_INHERIT_SLOTS; i++)
+    {
+        rl_inherit *inherit = &f->inherits[i];
+        int         empty   = RL_INHERIT_FREE;
+        if (__atomic_compare_exchange_n(&inherit->state, &empty, RL_INHERIT_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            inherit->parent = parent;
+            inherit->child  = 0;
+            //a fast lock taken or released from now on goes through the mutex holder, which waits for the record
+            __atomic_fetch_or(&f->fast_state, RL_FAST_SLOW, __ATOMIC_ACQ_REL);
+            return true;
+        }
+    }
+
+    __atomic_fetch_sub(&f->nb_inherits, 1, __ATOMIC_RELEASE);
+    return false;
+}
+
+static void complete_inheritance(rl_open_file *f, pid_t parent, pid_t child)
+{
+    //rl_fork holds the registry, a parent has a single reservation per file
+    for (int i = 0; i < RL_INHERIT_SLOTS; i++)
+    {
+        rl_inherit *inherit = &f->inherits[i];
+        if ((__atomic_load_n(&inherit->state, __ATOMIC_ACQUIRE) != RL_INHERIT_BUSY) || (inherit->parent != parent))
+        {
+            continue;
+        }
+
+        if (child > 0)
+        {
+            inherit->child = child;
+            __atomic_store_n(&inherit->state, RL_INHERIT_READY, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            __atomic_store_n(&inherit->state, RL_INHERIT_FREE, __ATOMIC_RELEASE);
+            __atomic_fetch_sub(&f->nb_inherits, 1, __ATOMIC_RELEASE);
+        }
+        return;
+    }
+}
+
+static bool resolve_inheritances(rl_open_file *f)
+{
+    bool isProgress = true;
+    bool isForking  = false;
+    while (isProgress)
+    {
+        isProgress = false;
+        isForking  = false;
+        for (int i = 0; i < RL_INHERIT_SLOTS; i++)
+        {
+            rl_inherit *inherit = &f->inherits[i];
+            int         busy    = RL_INHERIT_BUSY;
+            int         state   = __atomic_load_n(&inherit->state, __ATOMIC_ACQUIRE);
+
+            //a parent names its child right after fork() returns, its record is resolved by a later holder;
+            //only the parent's threads may release its locks meanwhile, and they wait for the fork
+            if (state == RL_INHERIT_BUSY)
+            {
+                if (inherit->parent == current_pid())
+                {
+                    isForking = true;
+                }
+                else if (    (!is_process_alive(inherit->parent))
+                          && (__atomic_compare_exchange_n(&inherit->state, &busy, RL_INHERIT_FREE, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                        )
+                {
+                    __atomic_fetch_sub(&f->nb_inherits, 1, __ATOMIC_RELEASE);
+                }
+                continue;
+            }
+            if (state != RL_INHERIT_READY)
+            {
+                continue;
+            }
+
+            //a grandchild inherits from its parent once the parent has inherited itself
+            bool isParentPending = false;
+            for (int j = 0; (j < RL_INHERIT_SLOTS) && (!isParentPending); j++)
+            {
+                isParentPending =    (__atomic_load_n(&f->inherits[j].state, __ATOMIC_ACQUIRE) == RL_INHERIT_READY)
+                                  && (f->inherits[j].child == inherit->parent);
+            }
+            if (isParentPending)
+            {
+                continue;
+            }
+
+            add_new_owner_by_pid(inherit->parent, inherit->child, f);
+            __atomic_store_n(&inherit->state, RL_INHERIT_FREE, __ATOMIC_RELEASE);
+            __atomic_fetch_sub(&f->nb_inherits, 1, __ATOMIC_RELEASE);
+            isProgress = true;
+        }
+    }
+    return !isForking;
+}
+
+static void delete_owner(rl_open_file *f, int index, owner own, bool isAllTokens)
+{
+    rl_lock *lck  = lock_at(f, index);
+    int     *link = &lck->owners;
+    while (*link >= 0)
+    {
+        int ownIdx = *link;
+        if (    (owner_at(f, ownIdx)->own.proc == own.proc)   //if this proc has lock.s for this fd
+             && (owner_at(f, ownIdx)->own.des  == own.des)
+             && ((isAllTokens) || (owner_at(f, ownIdx)->own.token == own.token))
+           )
+        {
+            *link = owner_at(f, ownIdx)->next;
+            proc_release(f, owner_at(f, ownIdx)->own.proc);
+            pool_free(f, &f->owner_pool, ownIdx);
+            lck->nb_owners--;    
+        }
+        else
+        {
+            link = &owner_at(f, ownIdx)->next;
+        }
+    }
+
+    if (!lck->nb_owners)
+    {
+        delete_lock(f, index);
+    }
+}
+
+static uint64_t owner_since(rl_open_file *f, rl_lock *l, owner own)
+{
+    for (int ownIdx = l->owners; ownIdx >= 0; ownIdx = owner_at(f, ownIdx)->next)
+    {
+        if (is_owners_are_equal(owner_at(f, ownIdx)->own, own))
+        {
+            return owner_at(f, ownIdx)->since;
+        }
+    }
+    return 0;
+}
+
+static void note_close_releases(rl_open_file *f, int index, owner own)
+{
+    rl_lock *lck = lock_at(f, index);
+    for (int ownIdx = lck->owners; ownIdx >= 0; ownIdx = owner_at(f, ownIdx)->next)
+    {
+        if ((owner_at(f, ownIdx)->own.proc == own.proc) && (owner_at(f, ownIdx)->own.des == own.des))
+        {
+            note_release(f, owner_at(f, ownIdx)->since, lck->starting_offset, lck->len);
+        }
+    }
+}
+
+static void note_release(rl_open_file *f, uint64_t since, off_t start, off_t len)
+{
+    uint64_t hold = (since) ? monotonic_ns() - since : 0;
+    (void)start; //only the probe reads it, it is compiled out without RL_HAS_PROBES
+    RL_PROBE3(release, start, len, hold);
+    if (!since)
+    {
+        return;
+    }
+
+    //size classes grow by 16, time classes by 2 from 1 us (1024 ns)
+    uint64_t us        = hold >> 10;
+    int      sizeClass = (63 - __builtin_clzll((uint64_t)len | 1)) / 4;
+    int      timeClass = (us) ? 64 - __builtin_clzll(us) : 0;
+    stat_add(&f->holds.counts[MIN(sizeClass, RL_HOLD_SIZES - 1)][MIN(timeClass, RL_HOLD_TIMES - 1)], 1);
+}
+
+static void delete_lock(rl_open_file *f, int index)
+{
+    index_remove(f, index);
+
+    lock_at(f, index)->nb_owners       = 0;
+    lock_at(f, index)->len             = 0;
+    lock_at(f, index)->starting_offset = 0;
+    lock_at(f, index)->type            = 0;
+    pool_free(f, &f->lock_pool, index);
+}
+
+//==============================================================================================================
+// fast path: while the lock table is empty, read locks are published in fast_locks with atomic operations.
+// A slot is taken by marking it RL_FAST_BUSY with the pid of the process, which then checks RL_FAST_SLOW; the
+// first mutex holder sets RL_FAST_SLOW, so either it sees the busy slot and waits for it, or the slot is given
+// back. It moves held slots to the lock table and reclaims busy slots of dead processes, nothing is counted
+// apart from the slots themselves. RL_FAST_SLOW is cleared once the table is empty and nobody waits.
+
+static bool fast_read_lock(rl_open_file *f, owner own, off_t start, off_t len)
+{
+    //locks of the same owner touching the region have to be joined, which is done by the lock table
+    if (    (__atomic_load_n(&f->fast_state, __ATOMIC_ACQUIRE) & RL_FAST_SLOW)
+         || (is_fast_touching(f, own, start, len, -1))
+       )
+    {
+        return false;
+    }
+
+    int busy = RL_FAST_BUSY(own.proc);
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
+    {
+        rl_fast_lock *fast  = &f->fast_locks[i];
+        int           empty = RL_FAST_FREE;
+        if (    (__atomic_load_n(&fast->state, __ATOMIC_RELAXED) != RL_FAST_FREE)
+             || (!__atomic_compare_exchange_n(&fast->state, &empty, busy, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+           )
+        {
+            continue;
+        }
+
+        //a mutex holder closing the path meanwhile either sees the busy slot and waits for it, or is seen here
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&f->fast_state, __ATOMIC_RELAXED) & RL_FAST_SLOW)
+        {
+            __atomic_store_n(&fast->state, RL_FAST_FREE, __ATOMIC_RELEASE);
+            return false;
+        }
+
+        fast->own   = own;
+        fast->start = start;
+        fast->len   = len;
+        fast->since = hold_clock(f);
+        //the busy slot has a single writer, rl_stats only loads the counter
+        __atomic_store_n(&fast->acquisitions, fast->acquisitions + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&fast->state, RL_FAST_HELD, __ATOMIC_RELEASE);
+
+        //a thread of the same owner may have published a touching region since the check: with a full fence
+        //between publishing and checking again, at least one of them sees the other and backs off
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (is_fast_touching(f, own, start, len, i))
+        {
+            int held = RL_FAST_HELD;
+            if (__atomic_compare_exchange_n(&fast->state, &held, busy, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            {
+                __atomic_store_n(&fast->acquisitions, fast->acquisitions - 1, __ATOMIC_RELAXED);
+                fast->own.proc = 0;
+                __atomic_store_n(&fast->state, RL_FAST_FREE, __ATOMIC_RELEASE);
+                return false;
+            }
+            //the mutex holder has moved it to the lock table meanwhile, where touching locks are joined
+        }
+
+        RL_PROBE4(grant, F_RDLCK, start, len, 1);
+        return true;
+    }
+
+    //every slot is taken
+    return false;
+}
+
+static bool is_fast_touching(rl_open_file *f, owner own, off_t start, off_t len, int except)
+{
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
+    {
+        rl_fast_lock *fast = &f->fast_locks[i];
+        if (    (i != except)
+             && (__atomic_load_n(&fast->state, __ATOMIC_ACQUIRE) == RL_FAST_HELD)
+             && (is_owners_are_equal(fast->own, own))
+             && (range_touches(fast->start, fast->start + fast->len, start, start + len))
+           )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_fast_locks(rl_open_file *f, pid_t pid)
+{
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
+    {
+        rl_fast_lock *fast = &f->fast_locks[i];
+        if ((RL_FAST_HELD == __atomic_load_n(&fast->state, __ATOMIC_ACQUIRE)) && (fast->own.proc == pid))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool fast_unlock(rl_open_file *f, owner own, off_t start, off_t len)
+{
+    //once the fast path is closed, fast locks are released by the mutex holder: a fork may be inheriting them
+    if (__atomic_load_n(&f->fast_state, __ATOMIC_ACQUIRE) & RL_FAST_SLOW)
+    {
+        return false;
+    }
+
+    int busy = RL_FAST_BUSY(own.proc);
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
+    {
+        rl_fast_lock *fast = &f->fast_locks[i];
+        int           held = RL_FAST_HELD;
+        if (    (__atomic_load_n(&fast->state, __ATOMIC_ACQUIRE) != RL_FAST_HELD)
+             || (!is_owners_are_equal(fast->own, own))
+             || (fast->start != start)
+             || (fast->len != len)
+           )
+        {
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&fast->state, &held, busy, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            //slot may have been released and taken again before we got it
+            if ((is_owners_are_equal(fast->own, own)) && (fast->start == start) && (fast->len == len))
+            {
+                uint64_t since = fast->since;
+                fast->own.proc = 0;
+                __atomic_store_n(&fast->state, RL_FAST_FREE, __ATOMIC_RELEASE);
+                note_release(f, since, start, len);
+                return true;
+            }
+            __atomic_store_n(&fast->state, RL_FAST_HELD, __ATOMIC_RELEASE);
+        }
+    }
+
+    return false;
+}
+
+static void rl_lock_file(rl_open_file *f)
+{
+    bool ownerDied = false;
+    for (;;)
+    {
+        if (EOWNERDEAD == pthread_mutex_lock(&f->mutex))
+        {
+            //the previous holder died inside a critical section, the table is assumed usable
+            RL_WARN("file mutex owner died, reaping dead processes");
+            pthread_mutex_consistent(&f->mutex);
+            ownerDied = true;
+        }
+
+        //odd seq: snapshot readers retry, it stays odd if the previous holder died in the middle of a change
+        __atomic_store_n(&f->seq, (f->seq + 1) | 1u, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        //a holder dying before the slots are drained leaves RL_FAST_DRAINED clear, the next one drains them
+        unsigned int state = __atomic_fetch_or(&f->fast_state, RL_FAST_SLOW, __ATOMIC_SEQ_CST);
+        if (!(state & RL_FAST_DRAINED))
+        {
+            drain_fast_locks(f);
+            __atomic_fetch_or(&f->fast_state, RL_FAST_DRAINED, __ATOMIC_RELEASE);
+        }
+
+        if ((0 == __atomic_load_n(&f->nb_inherits, __ATOMIC_ACQUIRE)) || (resolve_inheritances(f)))
+        {
+            break;
+        }
+
+        //another thread of this process is forking: its child has to inherit the locks this one may release
+        rl_unlock_file(f);
+        sched_yield();
+    }
+
+    if (ownerDied)
+    {
+        reap_dead_processes(f);
+    }
+}
+
+static void drain_fast_locks(rl_open_file *f)
+{
+    int busy = RL_FAST_BUSY(current_pid());
+    for (bool isBusy = true; isBusy; )
+    {
+        isBusy = false;
+        for (int i = 0; i < RL_FAST_SLOTS; i++)
+        {
+            rl_fast_lock *fast  = &f->fast_locks[i];
+            int           state = __atomic_load_n(&fast->state, __ATOMIC_ACQUIRE);
+            int           held  = RL_FAST_HELD;
+            if ((state == RL_FAST_HELD) && (__atomic_compare_exchange_n(&fast->state, &held, busy, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)))
+            {
+                //the table only holds read locks moved from fast slots, touching ones of an owner are joined
+                struct flock lck = {.l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = fast->start, .l_len = fast->len};
+                if (0 != join_owned_locks(f, &lck, fast->own, F_RDLCK, filter_owned, fast->since))
+                {
+                    PROC_ERROR("fast lock can't be moved to the lock table");
+                }
+                fast->own.proc = 0;
+                __atomic_store_n(&fast->state, RL_FAST_FREE, __ATOMIC_RELEASE);
+            }
+            else if ((state < 0) && (!is_process_alive(-state)))
+            {
+                //the process died changing the slot: a lock it was checking before a release belongs to
+                //another process, which keeps it; anything else is its own and goes with it
+                pid_t holder = fast->own.proc;
+                bool  isHeld = (holder != 0) && (holder != -state) && (is_process_alive(holder));
+                if (!isHeld)
+                {
+                    fast->own.proc = 0;
+                }
+                __atomic_compare_exchange_n(&fast->state, &state, isHeld ? RL_FAST_HELD : RL_FAST_FREE, false, 
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+                isBusy = true;
+            }
+            else if (state < 0)
+            {
+                //a change started before RL_FAST_SLOW is published, a lock taken meanwhile has to be moved
+                isBusy = true;
+            }
+        }
+
+        if (isBusy)
+        {
+            sched_yield();
+        }
+    }
+}
+
+static void rl_unlock_file(rl_open_file *f)
+{
+    if ((f->first < 0) && (f->first_waiter < 0) && (0 == __atomic_load_n(&f->nb_inherits, __ATOMIC_ACQUIRE)))
+    {
+        unsigned int state = RL_FAST_SLOW | RL_FAST_DRAINED;
+        __atomic_compare_exchange_n(&f->fast_state, &state, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&f->seq, f->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+//==============================================================================================================
+// waiters: each blocked F_SETLKW request sleeps on its own futex word, so releasing a region wakes up only the
+// requests it may satisfy instead of every process blocked on the file.
+
+static int add_waiter(rl_open_file *f, owner own, struct flock *lck, bool isFirst)
+{
+    int waiterIdx = pool_alloc(f, &f->waiter_pool);
+    if (waiterIdx < 0)
+    {
+        return -1;
+    }
+
+    rl_waiter *waiter = waiter_at(f, waiterIdx);
+    waiter->own   = own;
+    waiter->type  = lck->l_type;
+    waiter->start = lck->l_start;
+    waiter->len   = lck->l_len;
+    waiter->wake  = 0;
+    waiter->visit = f->visit_epoch;
+    waiter->next  = isFirst ? f->first_waiter : NEXT_NULL;
+    waiter->prev  = isFirst ? NEXT_NULL : f->last_waiter;
+
+    if (waiter->prev >= 0)
+    {
+        waiter_at(f, waiter->prev)->next = waiterIdx;
+    }
+    else
+    {
+        f->first_waiter = waiterIdx;
+    }
+    if (waiter->next >= 0)
+    {
+        waiter_at(f, waiter->next)->prev = waiterIdx;
+    }
+    else
+    {
+        f->last_waiter = waiterIdx;
+    }
+    f->blockCnt ++;
+
+    return waiterIdx;
+}
+
+static void delete_waiter(rl_open_file *f, int index)
+{
+    rl_waiter *waiter = waiter_at(f, index);
+
+    if (waiter->prev >= 0)
+    {
+        waiter_at(f, waiter->prev)->next = waiter->next;
+    }
+    else
+    {
+        f->first_waiter = waiter->next;
+    }
+    if (waiter->next >= 0)
+    {
+        waiter_at(f, waiter->next)->prev = waiter->prev;
+    }
+    else
+    {
+        f->last_waiter = waiter->prev;
+    }
+    f->blockCnt --;
+
+    pool_free(f, &f->waiter_pool, index);
+}
+
+/* end of the requested region, a flock length of 0 waits up to the end of file like a lock does */
+static inline off_t waiter_end(rl_waiter *waiter)
+{
+    return (0 == waiter->len) ? OFFSET_MAX : waiter->start + waiter->len;
+}
+
+static bool is_waiters_conflict(rl_waiter *w1, rl_waiter *w2)
+{
+    return    (!is_owners_are_equal(w1->own, w2->own))
+           && ((w1->type == F_WRLCK) || (w2->type == F_WRLCK))
+           && (range_overlaps(w1->start, waiter_end(w1), w2->start, waiter_end(w2)));
+}
+
+static void wake_waiters(rl_open_file *f, off_t start, off_t end)
+{
+    for (int waiterIdx = f->first_waiter; waiterIdx >= 0; waiterIdx = waiter_at(f, waiterIdx)->next)
+    {
+        rl_waiter *waiter = waiter_at(f, waiterIdx);
+        off_t      len    = waiter_end(waiter) - waiter->start;
+        if (    (waiter->wake)
+             || (!range_overlaps(waiter->start, waiter->start + len, start, end))
+             || (!is_compatible(f, waiter->own, waiter->type, waiter->start, len))
+             || (is_queued_behind(f, waiter->own, waiterIdx, waiter->type, waiter->start, len))
+           )
+        {
+            continue;
+        }
+
+        //only the first of conflicting waiters may get the region, let others sleep
+        bool isConflict = false;
+        for (int prevIdx = f->first_waiter; (prevIdx != waiterIdx) && (!isConflict); prevIdx = waiter_at(f, prevIdx)->next)
+        {
+            isConflict = (waiter_at(f, prevIdx)->wake) && (is_waiters_conflict(waiter_at(f, prevIdx), waiter));
+        }
+
+        if (!isConflict)
+        {
+            __atomic_store_n(&waiter->wake, 1, __ATOMIC_RELEASE);
+            futex_wake(&waiter->wake, 1);
+        }
+    }
+}
+
+//==============================================================================================================
+// pools: arena segments are appended to the shared object on demand and handed to one pool each. Slots are
+// addressed by index, so they stay valid in every process whatever address the object is mapped at.
+
+static void pool_init(rl_pool *pool, int slotSize)
+{
+    pool->first_free        = NEXT_NULL;
+    pool->nb_slots          = 0;
+    pool->slot_size         = slotSize;
+    pool->slots_per_segment = RL_SEGMENT_SIZE / slotSize;
+    pool->nb_segments       = 0;
+}
+
+static int grow_shared_object(rl_open_file *f)
+{
+    char pSharedMemName[SHARED_NAME_MAX_LEN];
+    int  fdSharedMemory = -1;
+    int  segment        = f->nb_segments;
+
+    if (segment >= RL_MAX_SEGMENTS)
+    {
+        PROC_ERROR("shared object reached RL_MAX_SEGMENTS");
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (!make_shared_name(f->dev, f->ino, pSharedMemName, SHARED_NAME_MAX_LEN))
+    {
+        return -1;
+    }
+
+    fdSharedMemory = shm_open(pSharedMemName, O_RDWR, 0);
+    if (0 > fdSharedMemory)
+    {
+        PROC_ERROR("shm_open() failure");
+        return -1;
+    }
+
+    if (0 > ftruncate(fdSharedMemory, RL_HEADER_SIZE + (off_t)(segment + 1) * RL_SEGMENT_SIZE))
+    {
+        PROC_ERROR("ftruncate() failure");
+        CLOSE_FILE(fdSharedMemory);
+        return -1;
+    }
+    CLOSE_FILE(fdSharedMemory);
+
+    f->nb_segments++;
+    return segment;
+}
+
+static int pool_grow(rl_open_file *f, rl_pool *pool)
+{
+    if (pool->nb_segments >= RL_MAX_SEGMENTS)
+    {
+        PROC_ERROR("pool reached RL_MAX_SEGMENTS");
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int segment = grow_shared_object(f);
+    if (segment < 0)
+    {
+        return -1;
+    }
+    pool->segments[pool->nb_segments++] = segment;
+
+    //chain new slots so that lower indexes are given first
+    for (int i = pool->nb_slots + pool->slots_per_segment - 1; i >= pool->nb_slots; i--)
+    {
+        *(int *)pool_slot(f, pool, i) = pool->first_free;
+        pool->first_free = i;
+    }
+    pool->nb_slots += pool->slots_per_segment;
+    return 0;
+}
 
-int rl_init_library() {
-    if (g_is_initialized)
+static int pool_reserve(rl_open_file *f, rl_pool *pool, int nb)
+{
+    int nbFree = 0;
+    for (int index = pool->first_free; (index >= 0) && (nbFree < nb); index = *(int *)pool_slot(f, pool, index))
     {
-        return 0;
+        nbFree++;
     }
 
-    int code = -1;    
-    if ((code = init_mutex(&rl_all_files.mutex)) != 0)
+    for (; nbFree < nb; nbFree += pool->slots_per_segment)
     {
-        PROC_ERROR(strerror(code));
-        return code;
+        if (0 != pool_grow(f, pool))
+        {
+            return -1;
+        }
     }
-    rl_all_files.nb_files = 0;
-    memset(rl_all_files.tab_open_files, 0, sizeof(rl_open_file*) * NB_FILES);   
+    return 0;
+}
 
-    g_is_initialized = true;
+static int pool_alloc(rl_open_file *f, rl_pool *pool)
+{
+    if ((pool->first_free < 0) && (0 != pool_grow(f, pool)))
+    {
+        return -1;
+    }
 
-    return code;
+    int index = pool->first_free;
+    pool->first_free = *(int *)pool_slot(f, pool, index);
+    return index;
 }
 
+static void pool_free(rl_open_file *f, rl_pool *pool, int index)
+{
+    *(int *)pool_slot(f, pool, index) = pool->first_free;
+    pool->first_free = index;
+}
 
-rl_descriptor rl_open(const char *path, int oflag, ...)
-{    
-    va_list        parameters;
-    mode_t         mode                   = -1;
-    int            fdFile, fdSharedMemory = -1;
-    char           pSharedMemName[SHARED_NAME_MAX_LEN];
-    char           pSharedSemName[SHARED_NAME_MAX_LEN];
-    sem_t         *sharedSem              = NULL;
-    rl_open_file*  pRlOpenFile            = NULL;
-    rl_descriptor  stRlDescriptor         = {.d = -1, .f = NULL};
-    bool           isNewFile              = true;
-    bool           isError                = false;
-    
-    // ======================================== get arguments ==========================================================
-    
-    if (oflag & O_CREAT)
+//==============================================================================================================
+// interval index: treap ordered by (starting_offset, index) and augmented by the max end offset of each subtree.
+// Nodes are linked by indexes of lock_table, so the index stays valid whatever address the segment is mapped at.
+
+static off_t lock_end(rl_lock *lck)
+{
+    return lck->starting_offset + lck->len;
+}
+
+static bool index_is_before(rl_open_file *f, int a, int b)
+{
+    off_t startA = lock_at(f, a)->starting_offset;
+    off_t startB = lock_at(f, b)->starting_offset;
+    return (startA < startB) || ((startA == startB) && (a < b));
+}
+
+static void index_update(rl_open_file *f, int node)
+{
+    rl_lock *lck = lock_at(f, node);
+    lck->max_end = lock_end(lck);
+    if ((lck->left >= 0) && (lock_at(f, lck->left)->max_end > lck->max_end))
     {
-        va_start(parameters, oflag);
-        mode = (mode_t)va_arg(parameters, int);
-        va_end(parameters);
+        lck->max_end = lock_at(f, lck->left)->max_end;
+    }
+    if ((lck->right >= 0) && (lock_at(f, lck->right)->max_end > lck->max_end))
+    {
+        lck->max_end = lock_at(f, lck->right)->max_end;
     }
+}
+
+static int index_rotate_right(rl_open_file *f, int node)
+{
+    int top = lock_at(f, node)->left;
+    lock_at(f, node)->left = lock_at(f, top)->right;
+    lock_at(f, top)->right = node;
+    index_update(f, node);
+    index_update(f, top);
+    return top;
+}
 
-    pthread_mutex_lock(&rl_all_files.mutex);
+static int index_rotate_left(rl_open_file *f, int node)
+{
+    int top = lock_at(f, node)->right;
+    lock_at(f, node)->right = lock_at(f, top)->left;
+    lock_at(f, top)->left = node;
+    index_update(f, node);
+    index_update(f, top);
+    return top;
+}
 
-    if (NB_FILES == rl_all_files.nb_files)
+static int index_insert_at(rl_open_file *f, int node, int index)
+{
+    if (node < 0)
     {
-        PROC_ERROR("Unable to proceed rl_open because the library's limit on the number of open files (NB_FILES) has been reached");
-        isError = true;
-        goto lExit;
+        return index;
     }
 
-    //first open the file, if we can't - everything else is useless 
-    fdFile = open(path, oflag, mode);
-    if (fdFile < 0)
+    if (index_is_before(f, index, node))
     {
-        PROC_ERROR("open() file failure");
-        isError = true;
-        goto lExit;
+        lock_at(f, node)->left = index_insert_at(f, lock_at(f, node)->left, index);
+        if (lock_at(f, lock_at(f, node)->left)->priority > lock_at(f, node)->priority)
+        {
+            node = index_rotate_right(f, node);
+        }
+    }
+    else
+    {
+        lock_at(f, node)->right = index_insert_at(f, lock_at(f, node)->right, index);
+        if (lock_at(f, lock_at(f, node)->right)->priority > lock_at(f, node)->priority)
+        {
+            node = index_rotate_left(f, node);
+        }
     }
 
-   
-    // =================== open or create shared memory object =========================================================
-    if (    (!make_shared_name_by_path(path, SHARED_PREFIX_MEM, pSharedMemName, SHARED_NAME_MAX_LEN))
-         || (!make_shared_name_by_path(path, SHARED_PREFIX_SEM, pSharedSemName, SHARED_NAME_MAX_LEN))
-       )
+    index_update(f, node);
+    return node;
+}
+
+static int index_remove_at(rl_open_file *f, int node, int index)
+{
+    if (node < 0)
     {
-        PROC_ERROR("making shared names failure!");
-        isError = true;
-        goto lExit;
+        return node;
+    }
+
+    if (node == index)
+    {
+        int left  = lock_at(f, node)->left;
+        int right = lock_at(f, node)->right;
+        if (left < 0)
+        {
+            return right;
+        }
+        if (right < 0)
+        {
+            return left;
+        }
+
+        //rotate node down until it becomes a leaf
+        if (lock_at(f, left)->priority > lock_at(f, right)->priority)
+        {
+            node = index_rotate_right(f, node);
+            lock_at(f, node)->right = index_remove_at(f, lock_at(f, node)->right, index);
+        }
+        else
+        {
+            node = index_rotate_left(f, node);
+            lock_at(f, node)->left = index_remove_at(f, lock_at(f, node)->left, index);
+        }
+    }
+    else if (index_is_before(f, index, node))
+    {
+        lock_at(f, node)->left = index_remove_at(f, lock_at(f, node)->left, index);
+    }
+    else
+    {
+        lock_at(f, node)->right = index_remove_at(f, lock_at(f, node)->right, index);
     }
 
-    printf("{%s} shared name %s\n", path, pSharedMemName);
+    index_update(f, node);
+    return node;
+}
+
+static void index_insert(rl_open_file *f, int index)
+{
+    rl_lock *lck = lock_at(f, index);
+
+    //xorshift, priorities only have to be independent from offsets
+    f->seed ^= f->seed << 13;
+    f->seed ^= f->seed >> 17;
+    f->seed ^= f->seed << 5;
+
+    lck->priority = f->seed;
+    lck->left     = NEXT_NULL;
+    lck->right    = NEXT_NULL;
+    lck->max_end  = lock_end(lck);
 
-    // use semaphore to protect process of creation shared memory
-    sharedSem = sem_open(pSharedSemName, O_CREAT | O_EXCL, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH, 0);
-    if (NULL == sharedSem)
+    //the predecessor in offset order is the last node we turned right at
+    int prevIdx = NEXT_NULL;
+    int node    = f->root;
+    while (node >= 0)
     {
-        sharedSem = sem_open(pSharedSemName, 0);
-        if (NULL == sharedSem)
+        if (index_is_before(f, node, index))
         {
-            PROC_ERROR("sem_open() failed");
-            isError = true;
-            goto lExit;  
+            prevIdx = node;
+            node    = lock_at(f, node)->right;
         }
-        if (0 > sem_wait(sharedSem))
+        else
         {
-            PROC_ERROR("sem_wait() error");
-            isError = true;
-            goto lExit;  
+            node    = lock_at(f, node)->left;
         }
     }
 
-    fdSharedMemory = shm_open(pSharedMemName, 
-                              O_CREAT | O_RDWR | O_EXCL,  
-                              S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    lck->prev_lock = prevIdx;
+    if (prevIdx >= 0)
+    {
+        lck->next_lock = lock_at(f, prevIdx)->next_lock;
+        lock_at(f, prevIdx)->next_lock = index;
+    }
+    else
+    {
+        lck->next_lock = f->first;
+        f->first = index;
+    }
+    if (lck->next_lock >= 0)
+    {
+        lock_at(f, lck->next_lock)->prev_lock = index;
+    }
+
+    f->root = index_insert_at(f, f->root, index);
+}
+
+static void index_remove(rl_open_file *f, int index)
+{
+    rl_lock *lck = lock_at(f, index);
+
+    f->root = index_remove_at(f, f->root, index);
 
-    if (0 <= fdSharedMemory)
+    if (lck->prev_lock >= 0)
     {
-        printf("new shared file %s!\n", pSharedMemName);
+        lock_at(f, lck->prev_lock)->next_lock = lck->next_lock;
     }
     else
     {
-        printf("existing shared file %s!\n", pSharedMemName);
-        isNewFile = false;
+        f->first = lck->next_lock;
+    }
+    if (lck->next_lock >= 0)
+    {
+        lock_at(f, lck->next_lock)->prev_lock = lck->prev_lock;
+    }
 
-        fdSharedMemory = shm_open(pSharedMemName, 
-                                  O_RDWR, 
-                                  S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    lck->next_lock = NEXT_NULL;
+    lck->prev_lock = NEXT_NULL;
+    lck->left      = NEXT_NULL;
+    lck->right     = NEXT_NULL;
+}
 
-        if (0 > fdSharedMemory)
-        {
-            PROC_ERROR("shm_open() failure");
-            isError = true;
-            goto lExit;  
-        }
+static void index_refresh_at(rl_open_file *f, int node, int index)
+{
+    if (node < 0)
+    {
+        return;
     }
+    if (node != index)
+    {
+        index_refresh_at(f, (index_is_before(f, index, node)) ? lock_at(f, node)->left : lock_at(f, node)->right, index);
+    }
+    index_update(f, node);
+}
 
-    if ((isNewFile) && (0 > ftruncate(fdSharedMemory, sizeof(rl_open_file))))
+static void index_reshape(rl_open_file *f, int index, off_t start, off_t len)
+{
+    rl_lock *lck      = lock_at(f, index);
+    off_t    oldStart = lck->starting_offset;
+    off_t    oldLen   = lck->len;
+
+    //a lock staying between its neighbours keeps its place in the tree, max_end is refreshed on the way to it
+    lck->starting_offset = start;
+    lck->len             = len;
+    if (    ((lck->prev_lock < 0) || (index_is_before(f, lck->prev_lock, index)))
+         && ((lck->next_lock < 0) || (index_is_before(f, index, lck->next_lock)))
+       )
     {
-        PROC_ERROR("ftruncate() failure");
-        isError = true;
-        goto lExit;  
+        index_refresh_at(f, f->root, index);
+        return;
     }
 
-    // map object to memory
-    pRlOpenFile = mmap(0, sizeof(rl_open_file), PROT_READ|PROT_WRITE, MAP_SHARED, fdSharedMemory, 0);
-    if (MAP_FAILED == (void *)pRlOpenFile)
+    //the tree is searched by the old key to take the lock out
+    lck->starting_offset = oldStart;
+    lck->len             = oldLen;
+    index_remove(f, index);
+    lck->starting_offset = start;
+    lck->len             = len;
+    index_insert(f, index);
+}
+
+static int index_find_at(rl_open_file *f, int node, off_t start, off_t end, lock_filter filter, void *ctx)
+{
+    //no lock of the subtree reaches start
+    if ((node < 0) || (lock_at(f, node)->max_end <= start))
     {
-        PROC_ERROR("mmap() failure");
-        isError = true;
-        goto lExit;  
+        return NEXT_NULL;
     }
 
-    if (isNewFile) 
+    int found = index_find_at(f, lock_at(f, node)->left, start, end, filter, ctx);
+    if (found >= 0)
     {
-        memset(pRlOpenFile, 0, sizeof(rl_open_file));
-        init_mutex(&pRlOpenFile->mutex);
+        return found;
+    }
 
-        init_cond(&pRlOpenFile->cond);
-        pRlOpenFile->blockCnt = 0;
+    //node and its right subtree begin after end
+    if (lock_at(f, node)->starting_offset >= end)
+    {
+        return NEXT_NULL;
+    }
 
-        pRlOpenFile->first = NEXT_NULL;
-        for (int i =0; i < NB_LOCKS; i++)
-        {
-            pRlOpenFile->lock_table[i].next_lock = NEXT_NULL;
-        }
+    if ((lock_end(lock_at(f, node)) > start) && (filter(f, node, ctx)))
+    {
+        return node;
     }
 
-    // ============================== register new rl_open_file in rl_all_files ========================================
-    rl_all_files.tab_open_files[rl_all_files.nb_files] = pRlOpenFile;
-    rl_all_files.nb_files++;
+    return index_find_at(f, lock_at(f, node)->right, start, end, filter, ctx);
+}
 
-    pRlOpenFile->refCnt++;
-    printf("Open: RC : %d\n", pRlOpenFile->refCnt);
+static int index_find(rl_open_file *f, off_t start, off_t end, lock_filter filter, void *ctx)
+{
+    return index_find_at(f, f->root, start, end, filter, ctx);
+}
 
-lExit:
 
-    pthread_mutex_unlock(&rl_all_files.mutex);
 
-    if (isError)
+static uint64_t get_file_size(int fd)
+{
+    struct stat l_sStat;
+    l_sStat.st_size = 0;
+    if (0 == fstat(fd, &l_sStat))
     {
-        CLOSE_FILE(fdFile);
-        fdFile = FILE_UNK;
+        return (uint64_t)l_sStat.st_size;
+    }
 
-        FREE_MMAP(pRlOpenFile, sizeof(rl_open_file));
-        pRlOpenFile = NULL;
+    return 0;
+}
 
-        if (isNewFile)
-        {
-            shm_unlink(pSharedMemName);
-        }
+static uint64_t get_current_position(int fd)
+{
+    return (uint64_t)lseek(fd, 0, SEEK_CUR);    
+}
+
+static bool is_region_intersection(off_t offset, off_t len, rl_lock *lck)
+{
+    return range_overlaps(offset, offset + len, lck->starting_offset, lock_end(lck));
+}
+
+static bool is_region_equal(off_t offset, off_t len, rl_lock *lck)
+{
+    return (offset == lck->starting_offset) & (len == lck->len);
+}
+
+static bool filter_conflict(rl_open_file *f, int index, void *ctx)
+{
+    lock_filter_ctx *req = ctx;
+    if (!is_other_owner(f, &req->own, lock_at(f, index)))
+    {
+        return false;
     }
+    return (req->type == F_WRLCK) || (lock_at(f, index)->type == F_WRLCK);
+}
 
-    CLOSE_FILE(fdSharedMemory);
+static bool is_compatible(rl_open_file *f, owner own, short type, off_t start, off_t len)
+{
+    lock_filter_ctx req = {.own = own, .type = type, .start = start, .len = len};
+
+    return index_find(f, start, start + len, filter_conflict, &req) < 0;
+}
+
+static bool filter_held_conflict(rl_open_file *f, int index, void *ctx)
+{
+    lock_filter_ctx *req = ctx;
+    return    ((req->type == F_WRLCK) || (lock_at(f, index)->type == F_WRLCK))
+           && (has_owner(f, lock_at(f, index), &req->own));
+}
+
+static bool is_queued_behind(rl_open_file *f, owner own, int waiterIdx, short type, off_t start, off_t len)
+{
+    if (f->policy == RL_POLICY_READERS)
+    {
+        return false;
+    }
 
-    if (sharedSem)
+    rl_waiter req    = {.own = own, .type = type, .start = start, .len = len};
+    bool      isAhead = true;   //waiter is queued before the request
+    for (int idx = f->first_waiter; idx >= 0; idx = waiter_at(f, idx)->next)
     {
-        sem_post(sharedSem);
-        sem_close(sharedSem);
-        if ((isError) && (isNewFile))
+        rl_waiter *waiter = waiter_at(f, idx);
+        if (idx == waiterIdx)
+        {
+            isAhead = false;
+            continue;
+        }
+
+        //FIFO: conflicting waiters ahead go first; WRITERS: writers ahead, and any writer for a reader
+        if (    (!is_waiters_conflict(waiter, &req))
+             || ((f->policy == RL_POLICY_FIFO) && (!isAhead))
+             || ((f->policy == RL_POLICY_WRITERS) && ((waiter->type != F_WRLCK) || ((!isAhead) && (type != F_RDLCK))))
+           )
+        {
+            continue;
+        }
+
+        //a waiter blocked by a lock of the requester can't go first, waiting for it would be a deadlock
+        lock_filter_ctx held = {.own = own, .type = waiter->type, .start = waiter->start, .len = waiter_end(waiter) - waiter->start};
+        if (index_find(f, waiter->start, waiter_end(waiter), filter_held_conflict, &held) < 0)
         {
-            sem_unlink(pSharedSemName);
+            return true;
         }
     }
 
-    stRlDescriptor.d = fdFile;
-    stRlDescriptor.f = pRlOpenFile;    
-    return stRlDescriptor;
+    return false;
 }
 
+static bool is_owner(rl_descriptor lfd, rl_lock *lck)
+{
+    owner o = descriptor_owner(lfd);
+    return has_owner(lfd.f, lck, &o);
+}
 
-int rl_close(rl_descriptor lfd)
+static bool is_other_owner(rl_open_file *f, owner *o, rl_lock *lck)
 {
-    char    pSharedMemName[SHARED_NAME_MAX_LEN];
-    char    pSharedSemName[SHARED_NAME_MAX_LEN];
-    sem_t  *sharedSem      = NULL;
-    bool    isError        = false;
-    int     rc             = -1;
-    bool    isLastRef      = false;
-    int     lockIdx        = NEXT_NULL;
+    for (int ownIdx = lck->owners; ownIdx >= 0; ownIdx = owner_at(f, ownIdx)->next)
+    {
+        if (!is_owners_are_equal(owner_at(f, ownIdx)->own, *o)) return true;
+    }
 
-    if ((lfd.d == FILE_UNK) || (!lfd.f))
+    return false;
+}
+
+static bool is_process_alive(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    //a pidfd becomes readable once the process has exited, zombies included
+    int pidFd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidFd >= 0)
     {
-        PROC_ERROR("wrong input");
-        return RES_ERR;
+        struct pollfd pfd = {.fd = pidFd, .events = POLLIN};
+        int           res = poll(&pfd, 1, 0);
+        close(pidFd);
+        return (res == 0);
+    }
+    if (errno == ESRCH)
+    {
+        return false;
     }
+#endif
+    //EPERM: process exists but belongs to another user
+    return (0 == kill(pid, 0)) || (errno != ESRCH);
+}
 
-    if (    (!make_shared_name_by_fd(lfd.d, SHARED_PREFIX_MEM, pSharedMemName, SHARED_NAME_MAX_LEN))
-         || (!make_shared_name_by_fd(lfd.d, SHARED_PREFIX_SEM, pSharedSemName, SHARED_NAME_MAX_LEN))
-       )
+static int proc_acquire(rl_open_file *f, pid_t pid)
+{
+    for (int procIdx = f->first_proc; procIdx >= 0; procIdx = proc_at(f, procIdx)->next)
     {
-        PROC_ERROR("making shared names failure!");
-        isError = true;
-        goto lExit;
+        if (proc_at(f, procIdx)->pid == pid)
+        {
+            proc_at(f, procIdx)->nb_owners ++;
+            return 0;
+        }
     }
 
-    sharedSem = sem_open(pSharedSemName, 0);
-    if (NULL == sharedSem)
+    int procIdx = pool_alloc(f, &f->proc_pool);
+    if (procIdx < 0)
     {
-        PROC_ERROR("sem_open() failed");
-        isError = true;
-        goto lExit;  
+        return -1;
+    }
+
+    proc_at(f, procIdx)->pid       = pid;
+    proc_at(f, procIdx)->nb_owners = 1;
+    proc_at(f, procIdx)->next      = f->first_proc;
+    f->first_proc = procIdx;
+    return 0;
+}
+
+static void proc_release(rl_open_file *f, pid_t pid)
+{
+    for (int *link = &f->first_proc; *link >= 0; link = &proc_at(f, *link)->next)
+    {
+        int procIdx = *link;
+        if (proc_at(f, procIdx)->pid == pid)
+        {
+            if (--proc_at(f, procIdx)->nb_owners <= 0)
+            {
+                *link = proc_at(f, procIdx)->next;
+                pool_free(f, &f->proc_pool, procIdx);
+            }
+            return;
+        }
+    }
+}
+
+static void reap_process(rl_open_file *f, pid_t pid)
+{
+    RL_WARN("reaping dead process %d", pid);
+
+    int lockIdx = f->first;
+    while (lockIdx >= 0)
+    {
+        rl_lock *lck      = lock_at(f, lockIdx);
+        int      nextLock = lck->next_lock;
+        int     *link     = &lck->owners;
+        while (*link >= 0)
+        {
+            int ownIdx = *link;
+            if (owner_at(f, ownIdx)->own.proc == pid)
+            {
+                *link = owner_at(f, ownIdx)->next;
+                proc_release(f, pid);
+                pool_free(f, &f->owner_pool, ownIdx);
+                lck->nb_owners--;    
+            }
+            else
+            {
+                link = &owner_at(f, ownIdx)->next;
+            }
+        }
+
+        if (!lck->nb_owners) //if there is no more owners for lock -> remove lock from lock_table
+        {
+            delete_lock(f, lockIdx);
+        }
+        lockIdx = nextLock;
     }
-    if (0 > sem_wait(sharedSem))
+
+    int waiterIdx = f->first_waiter;
+    while (waiterIdx >= 0)
     {
-        PROC_ERROR("sem_wait() error");
-        isError = true;
-        goto lExit;  
+        int nextWaiter = waiter_at(f, waiterIdx)->next;
+        if (waiter_at(f, waiterIdx)->own.proc == pid)
+        {
+            delete_waiter(f, waiterIdx);
+        }
+        waiterIdx = nextWaiter;
     }
 
-    pthread_mutex_lock(&lfd.f->mutex);
+    wake_waiters(f, 0, OFFSET_MAX);
+}
 
-    printf("looking through locks...\n");
-    lockIdx = lfd.f->first;
-    while (lockIdx >= 0)
+static void reap_dead_processes(rl_open_file *f)
+{
+    int procIdx = f->first_proc;
+    while (procIdx >= 0)
     {
-        int nextLock = lfd.f->lock_table[lockIdx].next_lock;
-        delete_owner(lfd.f, lockIdx, lfd.d);
-        lockIdx = nextLock;
+        //reaping may free the entry
+        int   nextProc = proc_at(f, procIdx)->next;
+        pid_t pid      = proc_at(f, procIdx)->pid;
+        if (!is_process_alive(pid))
+        {
+            reap_process(f, pid);
+            nextProc = f->first_proc;
+        }
+        procIdx = nextProc;
     }
 
-    lfd.f->refCnt --;
-    printf("Close: RC : %d!\n", lfd.f->refCnt);
-    if (lfd.f->refCnt <= 0)
+    //waiters don't own locks, so a waiter that died may not be registered
+    int waiterIdx = f->first_waiter;
+    while (waiterIdx >= 0)
     {
-        isLastRef = true;    
+        int   nextWaiter = waiter_at(f, waiterIdx)->next;
+        pid_t pid        = waiter_at(f, waiterIdx)->own.proc;
+        if (!is_process_alive(pid))
+        {
+            reap_process(f, pid);
+            nextWaiter = f->first_waiter;
+        }
+        waiterIdx = nextWaiter;
     }
+}
 
-    rc = lfd.f->refCnt;
+static bool reap_conflicting_owners(rl_open_file *f, owner own, struct flock *lck)
+{
+    lock_filter_ctx req    = {.own = own, .type = lck->l_type, .start = lck->l_start, .len = lck->l_len};
+    bool            reaped = false;
+    int             lockIdx;
 
-    for (int i = 0; i < rl_all_files.nb_files; i++)    
+    //each conflicting lock is either alive and ends the search or is removed with its dead owners
+    while ((lockIdx = index_find(f, lck->l_start, lck->l_start + lck->l_len, filter_conflict, &req)) >= 0)
     {
-        if (lfd.f == rl_all_files.tab_open_files[i])
+        pid_t deadPid = 0;
+        for (int ownIdx = lock_at(f, lockIdx)->owners; ownIdx >= 0; ownIdx = owner_at(f, ownIdx)->next)
         {
-            if ((i+1) < rl_all_files.nb_files)
+            pid_t pid = owner_at(f, ownIdx)->own.proc;
+            if ((pid != own.proc) && (!is_process_alive(pid)))
             {
-                memmove(&rl_all_files.tab_open_files[i],    // erase open file from array by shifting all next ones
-                        &rl_all_files.tab_open_files[i+1],
-                        sizeof(rl_open_file*) * (rl_all_files.nb_files - (i+1)) );
-                i--;
+                deadPid = pid;
+                break;
             }
-            rl_all_files.nb_files--;    
+        }
+
+        if (!deadPid)
+        {
             break;
         }
+        reap_process(f, deadPid);
+        reaped = true;
     }
 
-    pthread_mutex_unlock(&lfd.f->mutex);
+    return reaped;
+}
 
-lExit:
-    CLOSE_FILE(lfd.d);
+static bool filter_wait_cycle(rl_open_file *f, int index, void *ctx);
 
-    if (isLastRef)
+static bool is_waiting_for(rl_open_file *f, owner waiting, owner origin, int depth)
+{
+    for (int waiterIdx = f->first_waiter; waiterIdx >= 0; waiterIdx = waiter_at(f, waiterIdx)->next)
     {
-        printf("last ref!\n");
+        rl_waiter *waiter = waiter_at(f, waiterIdx);
 
-        if (lfd.f->first >= 0)
+        //woken waiters are about to be granted, explored ones led nowhere during this pass
+        if (    (waiter->wake)
+             || (waiter->visit == f->visit_epoch)
+             || (!is_owners_are_equal(waiter->own, waiting))
+           )
         {
-            PROC_ERROR("Last reference deleted, but file locks aren't deleted!");
+            continue;
         }
+        waiter->visit = f->visit_epoch;
 
-        pthread_cond_destroy(&lfd.f->cond);
-        pthread_mutex_destroy(&lfd.f->mutex);
-        FREE_MMAP(lfd.f, sizeof(rl_open_file));
-        shm_unlink(pSharedMemName);
-        CLOSE_FILE(lfd.d);
-    }
-
-    if (sharedSem)
-    {
-        sem_post(sharedSem);
-        sem_close(sharedSem);
-        if (isLastRef)
+        wait_cycle_ctx cycle = {.req    = {.own = waiting, .type = waiter->type, .start = waiter->start, .len = waiter->len},
+                                .origin = origin,
+                                .depth  = depth};
+        if (index_find(f, waiter->start, waiter->start + waiter->len, filter_wait_cycle, &cycle) >= 0)
         {
-            sem_unlink(pSharedSemName);
+            return true;
         }
     }
 
-    return isError ? -1 : rc;
+    return false;
 }
 
-//==============================================================================================================
-
-rl_descriptor rl_dup(rl_descriptor lfd){
-    rl_descriptor ret       = {.d   = -1,    .f    = NULL    };
-    owner         new_owner = {.des = -1,    .proc = getpid()};
-    owner         own       = {.des = lfd.d, .proc = getpid()};
-
-    if ((lfd.d == FILE_UNK) || (!lfd.f))
-    {
-        PROC_ERROR("wrong input");
-        return ret;
-    }
-
-    pthread_mutex_lock(&lfd.f->mutex);
-
-    if (NB_FILES <= rl_all_files.nb_files)
+static bool filter_wait_cycle(rl_open_file *f, int index, void *ctx)
+{
+    wait_cycle_ctx *cycle = ctx;
+    if (!filter_conflict(f, index, &cycle->req))
     {
-        PROC_ERROR("Unable to proceed rl_open because the library's limit on the number of open files (NB_FILES) has been reached");
-        goto lExit;
+        return false;
     }
 
-    // Gestion erreur
-    int add = can_add_new_owner(own, lfd.f);
-    if(add == -1) 
+    for (int ownIdx = lock_at(f, index)->owners; ownIdx >= 0; ownIdx = owner_at(f, ownIdx)->next)
     {
-        PROC_ERROR("rl_dup() failure NB_OWNERS at max");
-        goto lExit;
+        owner holder = owner_at(f, ownIdx)->own;
+        if (is_owners_are_equal(holder, cycle->req.own))
+        {
+            continue;
+        }
+        if (    (is_owners_are_equal(holder, cycle->origin))
+             || ((cycle->depth < RL_DEADLOCK_DEPTH) && (is_waiting_for(f, holder, cycle->origin, cycle->depth + 1)))
+           )
+        {
+            return true;
+        }
     }
 
-    new_owner.des = dup(lfd.d);
-    if(new_owner.des == -1) 
-    {
-        PROC_ERROR("dup() failure"); // no close of newd (ref man dup)
-        goto lExit;
-    }
+    return false;
+}
 
-    if(add == 1) 
+static bool is_wait_cycle(rl_open_file *f, owner own, struct flock *lck)
+{
+    if (f->first_waiter < 0)
     {
-        add_new_owner(own, new_owner, lfd.f);
+        return false;
     }
 
-    ret.d = new_owner.des;
-    ret.f = lfd.f;
-    lfd.f->refCnt++;
-    rl_all_files.tab_open_files[rl_all_files.nb_files] = lfd.f;
-    rl_all_files.nb_files++;
-    
-    printf("Dup: RC : %d Fd:%d\n", lfd.f->refCnt, new_owner.des);
-
-lExit:    
-    pthread_mutex_unlock(&lfd.f->mutex);
+    f->visit_epoch ++;
+    wait_cycle_ctx cycle = {.req    = {.own = own, .type = lck->l_type, .start = lck->l_start, .len = lck->l_len},
+                            .origin = own,
+                            .depth  = 0};
 
-    return ret;
+    return index_find(f, lck->l_start, lck->l_start + lck->l_len, filter_wait_cycle, &cycle) >= 0;
 }
 
+static int add_owner(rl_descriptor lfd, rl_lock *lck)
+{
+    owner o = descriptor_owner(lfd);
 
-rl_descriptor rl_dup2(rl_descriptor lfd, int newd) {
-    rl_descriptor ret       = {.d   = -1,    .f    = NULL    };
-    owner         new_owner = {.des = newd,  .proc = getpid()};
-    owner         own       = {.des = lfd.d, .proc = getpid()};
-    
-    if ((lfd.d == FILE_UNK) || (!lfd.f))
+    if (!has_owner(lfd.f, lck, &o))
     {
-        PROC_ERROR("wrong input");
-        return ret;
+        return push_owner(lfd.f, lck, o, hold_clock(lfd.f));
     }
 
-    pthread_mutex_lock(&lfd.f->mutex);
-
-    if (NB_FILES <= rl_all_files.nb_files)
-    {
-        PROC_ERROR("Unable to proceed rl_open because the library's limit on the number of open files (NB_FILES) has been reached");
-        goto lExit;
-    }
+    return 0;
+}
 
-    // Gestion erreur
-    int add = can_add_new_owner(own, lfd.f);
-    if(add == -1) 
+static int add_lock(rl_open_file *f, struct flock *lck, owner own, int type, uint64_t since)
+{
+    int lockIdx = pool_alloc(f, &f->lock_pool);
+    if (lockIdx < 0)
     {
-        PROC_ERROR("rl_dup() failure NB_OWNERS at max");
-        goto lExit;
+        PROC_ERROR("Lock has no free space");
+        errno = EAGAIN;
+        return -1;
     }
 
-    if(dup2(lfd.d, newd) == -1) 
-    {
-        PROC_ERROR("dup() failure"); // no close of newd (ref man dup)
-        goto lExit;
-    }
+    rl_lock *newLock         = lock_at(f, lockIdx);
+    newLock->starting_offset = lck->l_start;
+    newLock->len             = lck->l_len;
+    newLock->type            = type;
+    newLock->owners          = NEXT_NULL;
+    newLock->nb_owners       = 0;
 
-    if(add == 1) 
+    if (0 != push_owner(f, newLock, own, since))
     {
-        add_new_owner(own, new_owner, lfd.f);
+        pool_free(f, &f->lock_pool, lockIdx);
+        errno = EAGAIN;
+        return -1;
     }
 
-    ret.d = new_owner.des;
-    ret.f = lfd.f;
-    lfd.f->refCnt++;
-
-    rl_all_files.tab_open_files[rl_all_files.nb_files] = lfd.f;
-    rl_all_files.nb_files++;
+    index_insert(f, lockIdx);
+    return 0;
+}
 
-    printf("Dup2: RC : %d\n", lfd.f->refCnt);
+static bool filter_equal(rl_open_file *f, int index, void *ctx)
+{
+    lock_filter_ctx *req = ctx;
+    return is_region_equal(req->start, req->len, lock_at(f, index));
+}
 
-lExit:    
-    pthread_mutex_unlock(&lfd.f->mutex);
+static bool filter_sole_owned(rl_open_file *f, int index, void *ctx)
+{
+    lock_filter_ctx *req = ctx;
+    rl_lock         *lck = lock_at(f, index);
+    return    (lck->type == req->type)
+           && (lck->nb_owners == 1)
+           && (is_region_equal(req->start, req->len, lck))
+           && (has_owner(f, lck, &req->own));
+}
 
-    return ret;
+static bool filter_owned(rl_open_file *f, int index, void *ctx)
+{
+    lock_filter_ctx *req = ctx;
+    return has_owner(f, lock_at(f, index), &req->own);
 }
 
-pid_t rl_fork() 
+static bool filter_owned_write_merge(rl_open_file *f, int index, void *ctx)
 {
-    for(int i = 0; i < rl_all_files.nb_files; i++)
-    {
-        pthread_mutex_lock(&rl_all_files.tab_open_files[i]->mutex);
-        if(can_add_new_owner_by_pid(getppid(), rl_all_files.tab_open_files[i]) == -1) 
-        {
-            pthread_mutex_unlock(&rl_all_files.tab_open_files[i]->mutex);
-            PROC_ERROR("rl_fork() failure NB_OWNERS at max");
-            return -1;
-        }
-        pthread_mutex_unlock(&rl_all_files.tab_open_files[i]->mutex);
-    }
+    lock_filter_ctx *req = ctx;
 
-    pid_t pid;
-    switch(pid = fork()) 
+    //neighbours are joined only if they have the same type, intersections are always absorbed
+    if (    (lock_at(f, index)->type != req->type)
+         && (!is_region_intersection(req->start, req->len, lock_at(f, index)))
+       )
     {
-        case 0 :
-            for(int i = 0; i < rl_all_files.nb_files; i++)
-            {
-                pthread_mutex_lock(&rl_all_files.tab_open_files[i]->mutex);
-                add_new_owner_by_pid(getppid(), getpid(), rl_all_files.tab_open_files[i]);
-                rl_all_files.tab_open_files[i]->refCnt++;
-                printf("[%d] Fork: RC : %d\n", getpid(), rl_all_files.tab_open_files[i]->refCnt);
-                pthread_mutex_unlock(&rl_all_files.tab_open_files[i]->mutex);
-            }
+        return false;
     }
-    return pid;
+    return has_owner(f, lock_at(f, index), &req->own);
 }
 
-
-int rl_fcntl(rl_descriptor lfd, int cmd, struct flock *lck)
+static int add_read_lock_region(rl_descriptor lfd, struct flock *lck)
 {
-    if ((lfd.d == FILE_UNK) || (!lfd.f) || (F_GETLK == cmd) || (!lck))
+    lock_filter_ctx req = {.own = descriptor_owner(lfd), .type = F_RDLCK, .start = lck->l_start, .len = lck->l_len};
+
+    //search for exact segment
+    int lockIdx = index_find(lfd.f, lck->l_start, lck->l_start + lck->l_len, filter_equal, &req);
+    if (lockIdx >= 0)
     {
-        PROC_ERROR("wrong input");
-        return -1;
+        if (is_owner(lfd, lock_at(lfd.f, lockIdx)))
+        {
+            return 0;
+        }
+        else
+        {
+            return add_owner(lfd, lock_at(lfd.f, lockIdx));
+        }
     }
 
-    struct flock lc         = *lck;
-    int          ret        = 0;
-    bool         isBlocking = (F_SETLKW == cmd);
-
-    //align start & len to make common way
-    if (lc.l_whence == SEEK_CUR)      { lc.l_start = (__off_t)get_current_position(lfd.d) + lc.l_start;  }
-    else if (lc.l_whence == SEEK_END) { lc.l_start = (__off_t)get_file_size(lfd.d) + lc.l_start;         }
-    if (lc.l_len == 0)                { lc.l_len   = (__off_t)get_file_size(lfd.d) - lc.l_start;         }
-    if (lc.l_len < 0)                 { lc.l_start += lc.l_len; lc.l_len = -lc.l_len;                  }
-    
-    lc.l_pid = getpid();
-    lc.l_whence = SEEK_SET; 
-
-    pthread_mutex_lock(&lfd.f->mutex);
+    //join all intersections or neighbours where lfd is owner
+    return join_owned_locks(lfd.f, lck, req.own, F_RDLCK, filter_owned, hold_clock(lfd.f));
+}
 
-    rl_clear_dead_owners(lfd);
+static int add_write_lock_region(rl_descriptor lfd, struct flock *lck)
+{
+    return join_owned_locks(lfd.f, lck, descriptor_owner(lfd), F_WRLCK, filter_owned_write_merge, hold_clock(lfd.f));
+}
 
+static int join_owned_locks(rl_open_file *f, struct flock *lck, owner own, short type, lock_filter filter, uint64_t since)
+{
+    lock_filter_ctx req   = {.own = own, .type = type};
+    int             host  = NEXT_NULL;
+    off_t           scanned;
 
-    if (lc.l_type == F_UNLCK)
+    //the locks joined follow the first one found in offset order,
+    //the scan is repeated only if the region grew to the left of it
+    do
     {
-        ret = delete_lock_region(lfd, &lc);
+        scanned   = lck->l_start;
+        req.start = lck->l_start;
+        req.len   = lck->l_len;
 
-        //if any process is waiting -> unblock
-        if (lfd.f->blockCnt)
+        int lockIdx = index_find(f, lck->l_start - 1, range_next(lck->l_start + lck->l_len), filter, &req);
+        while ((lockIdx >= 0) && (lock_at(f, lockIdx)->starting_offset <= lck->l_start + lck->l_len))
         {
-            printf("!!!SIGNALLED!!!\n");
+            rl_lock *l    = lock_at(f, lockIdx);
+            int      next = l->next_lock;
 
-            //clear block counter and notify all
-            lfd.f->blockCnt = 0;
-            pthread_cond_broadcast(&lfd.f->cond);
-        }
-    }
-    else
-    {
-        if (isBlocking)
-        {
-            while (1)
+            if (    (lockIdx != host)
+                 && (range_touches(l->starting_offset, lock_end(l), lck->l_start, lck->l_start + lck->l_len))
+                 && (filter(f, lockIdx, &req))
+               )
             {
-                if (!is_rl_compatible(lfd, &lc))
+                range_merge(&lck->l_start, &lck->l_len, l->starting_offset, l->len);
+                stat_add(&f->stats.merges, 1);
+                RL_PROBE2(merge, lck->l_start, lck->l_len);
+                req.start = lck->l_start;
+                req.len   = lck->l_len;
+                since     = hold_min(since, owner_since(f, l, own));
+
+                //the first lock the owner holds alone is extended in place, the others are dropped
+                if ((host < 0) && (l->nb_owners == 1))
                 {
-                    printf("!!!BLOCKED!!!\n");                    
-                    lfd.f->blockCnt ++;                    
-                    pthread_cond_wait(&lfd.f->cond, &lfd.f->mutex);
+                    host = lockIdx;
                 }
                 else
                 {
-                    printf("!!!UNBLOCKED!!!\n");
-                    break;
+                    delete_owner(f, lockIdx, own, false);
                 }
             }
+            lockIdx = next;
         }
-        else
+    } while (lck->l_start < scanned);
+
+    if (host < 0)
+    {
+        return add_lock(f, lck, own, type, since);
+    }
+
+    lock_at(f, host)->type = type;
+    owner_at(f, lock_at(f, host)->owners)->since = since;
+    index_reshape(f, host, lck->l_start, lck->l_len);
+    return 0;
+}
+
+static int delete_lock_region(rl_descriptor lfd, struct flock *lck)
+{
+    lock_filter_ctx req      = {.own = descriptor_owner(lfd), .type = F_UNLCK, .start = lck->l_start, .len = lck->l_len};
+    off_t           unlStart = lck->l_start;
+    off_t           unlEnd   = lck->l_start + lck->l_len;
+
+    //the other locks intersecting the region follow the first one found in offset order,
+    //pieces left by a cut are outside of the region so the scan never meets them again
+    int lockIdx = index_find(lfd.f, unlStart, unlEnd, filter_owned, &req);
+    while ((lockIdx >= 0) && (lock_at(lfd.f, lockIdx)->starting_offset < unlEnd))
+    {
+        rl_lock *l        = lock_at(lfd.f, lockIdx);
+        int      next     = l->next_lock;
+        off_t    lckStart = l->starting_offset;
+        off_t    lckEnd   = lock_end(l);
+
+        if ((!range_overlaps(unlStart, unlEnd, lckStart, lckEnd)) || (!has_owner(lfd.f, l, &req.own)))
         {
-            if (!is_rl_compatible(lfd, &lc))
-            {
-                ret = -1;
-                PROC_ERROR("Lock isn't compatible");
-                errno = EAGAIN;
-                goto lExit;
-            }
+            lockIdx = next;
+            continue;
         }
 
-        if (lc.l_type == F_RDLCK)
+        uint64_t since = owner_since(lfd.f, l, req.own);
+
+        //if lock region is include in unlock region
+        if ((unlStart <= lckStart) && (unlEnd >= lckEnd))
         {
-            ret = add_read_lock_region(lfd, &lc);
+            delete_owner(lfd.f, lockIdx, req.own, false);
         }
-        else if (lc.l_type == F_WRLCK)
+        else
         {
-            ret = add_write_lock_region(lfd, &lc);
+            stat_add(&lfd.f->stats.splits, 1);
+            RL_PROBE4(split, lckStart, lckEnd - lckStart, unlStart, unlEnd - unlStart);
+            if (0 != cut_lock(lfd.f, lockIdx, req.own, since, unlStart, unlEnd))
+            {
+                return -1;
+            }
         }
-    }
-
 
-lExit:    
-    pthread_mutex_unlock(&lfd.f->mutex);
+        note_release(lfd.f, since, MAX(unlStart, lckStart), MIN(unlEnd, lckEnd) - MAX(unlStart, lckStart));
+        lockIdx = next;
+    }
 
-    return ret;
+    return 0;
 }
 
-
-void rl_print(rl_descriptor lfd)
+static int cut_lock(rl_open_file *f, int index, owner own, uint64_t since, off_t unlStart, off_t unlEnd)
 {
-    if ((lfd.d == -1) || (!lfd.f))
+    rl_lock      *l        = lock_at(f, index);
+    short         type     = l->type;
+    off_t         lckStart = l->starting_offset;
+    off_t         lckEnd   = lock_end(l);
+    struct flock  left     = {.l_type = type, .l_whence = SEEK_SET, .l_start = lckStart, .l_len = unlStart - lckStart};
+    struct flock  right    = {.l_type = type, .l_whence = SEEK_SET, .l_start = unlEnd,   .l_len = lckEnd - unlEnd};
+
+    //other owners keep the whole region, the owner gets locks of its own for the pieces left
+    if (l->nb_owners > 1)
     {
-        PROC_ERROR("wrong input");
-        return;
+        if (    ((unlStart > lckStart) && (0 != add_lock(f, &left, own, type, since)))
+             || ((unlEnd < lckEnd) && (0 != add_lock(f, &right, own, type, since)))
+           )
+        {
+            return -1;
+        }
+        delete_owner(f, index, own, false);
+        return 0;
     }
 
-    printf(KRED "> RL d:%d, references %d" KNRM, lfd.d, lfd.f->refCnt);
-    
-    int lockIdx = lfd.f->first;
-    while (lockIdx >= 0)
+    //the lock keeps a piece in place, a hole only adds the right piece
+    if (unlStart > lckStart)
     {
-        printf(KGRN " > Lock [%ld..%ld], %s, owners %zu" KNRM, 
-               lfd.f->lock_table[lockIdx].starting_offset,
-               lfd.f->lock_table[lockIdx].starting_offset + lfd.f->lock_table[lockIdx].len - 1,
-               lfd.f->lock_table[lockIdx].type == F_RDLCK ? "RD" : "WR",
-               lfd.f->lock_table[lockIdx].nb_owners
-              );
-        for (size_t i = 0; i < lfd.f->lock_table[lockIdx].nb_owners; i++)
+        if ((unlEnd < lckEnd) && (0 != add_lock(f, &right, own, type, since)))
         {
-            printf(KBLU "   > Owner %d:%d" KNRM, 
-                lfd.f->lock_table[lockIdx].lock_owners[i].des,
-                lfd.f->lock_table[lockIdx].lock_owners[i].proc);
+            return -1;
         }
-        lockIdx = lfd.f->lock_table[lockIdx].next_lock;
+        index_reshape(f, index, lckStart, unlStart - lckStart);
     }
-    printf(KNRM);
+    else
+    {
+        index_reshape(f, index, unlEnd, lckEnd - unlEnd);
+    }
+    return 0;
 }
 
-////////////////////////////////////         AUXILIARY FONCTIONS       /////////////////////////////////////////////////
-//////////                                                                                                      ////////
-
-static int init_mutex(pthread_mutex_t *pMutex)
+static int reserve_requests(rl_open_file *f, owner own, struct flock *lcks, size_t nb)
 {
-    pthread_mutexattr_t mutexAttr;
-    int code = pthread_mutexattr_init(&mutexAttr);
-    if (code != 0)
+    lock_filter_ctx req     = {.own = own, .type = F_UNLCK};
+    int             nbLocks = 0;
+    int             nbMade  = 0;
+
+    //locks made by the previous requests of the set may be cut again, into two pieces at most
+    for (size_t i = 0; i < nb; i++)
     {
-        return code;
+        off_t start = lcks[i].l_start;
+        off_t end   = lcks[i].l_start + lcks[i].l_len;
+        int   nbNew = 1;
+
+        if (lcks[i].l_type == F_UNLCK)
+        {
+            nbNew = 2 * nbMade;
+            for (int lockIdx = index_find(f, start, end, filter_owned, &req);
+                 (lockIdx >= 0) && (lock_at(f, lockIdx)->starting_offset < end);
+                 lockIdx = lock_at(f, lockIdx)->next_lock)
+            {
+                rl_lock *l = lock_at(f, lockIdx);
+                if ((range_overlaps(start, end, l->starting_offset, lock_end(l))) && (has_owner(f, l, &own)))
+                {
+                    nbNew += (l->starting_offset < start) + (lock_end(l) > end);
+                }
+            }
+        }
+        nbLocks += nbNew;
+        nbMade  += nbNew;
     }
-    code = pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
-    if (code != 0)
+
+    if (    (0 != pool_reserve(f, &f->lock_pool, nbLocks))
+         || (0 != pool_reserve(f, &f->owner_pool, nbLocks))
+         || (0 != pool_reserve(f, &f->proc_pool, 1))
+       )
     {
-        return code;
+        return -1;
     }
-    code = pthread_mutex_init(pMutex, &mutexAttr);
-    return code;
+    return 0;
 }
 
 
-static int init_cond(pthread_cond_t *pCond)
+//==============================================================================================================
+// logging: writers reserve a ticket with a CAS on head and publish the entry through its seq; the flusher writes
+// published entries in ticket order and releases them by moving tail.
+
+void rl_set_log_level(int level)
 {
-    pthread_condattr_t condAttr;
-    int code;
-    code = pthread_condattr_init(&condAttr);
+    __atomic_store_n(&g_log.level, level, __ATOMIC_RELAXED);
+}
 
-    if (code != 0)
-    {
-        return code;
-    }
-    
-    code = pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
-    if (code != 0)
+static void log_write(int level, const char *format, ...)
+{
+    unsigned int ticket = __atomic_load_n(&g_log.head, __ATOMIC_RELAXED);
+    do
     {
-        return code;
-    }
-    return pthread_cond_init(pCond, &condAttr);
-}
+        if ((ticket - __atomic_load_n(&g_log.tail, __ATOMIC_ACQUIRE)) >= RL_LOG_RING_SIZE)
+        {
+            __atomic_fetch_add(&g_log.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&g_log.head, &ticket, ticket + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 
+    rl_log_entry *entry = &g_log.entries[ticket & (RL_LOG_RING_SIZE - 1)];
+    va_list       parameters;
 
-static bool make_shared_name_by_path(const char *filePath, char type, char *name, size_t maxLen)
-{        
-    int returnValue = -1;
-    struct stat statBuffer;
-    
-    if ((!filePath) || (!name))
-    {
-        PROC_ERROR("wrong arguments");
-        return NULL;
-    }
+    va_start(parameters, format);
+    vsnprintf(entry->msg, RL_LOG_MSG_LEN, format, parameters);
+    va_end(parameters);
 
-    returnValue = stat(filePath, &statBuffer);
-    if (returnValue < 0)
+    entry->level = level;
+    __atomic_store_n(&entry->seq, ticket + 1, __ATOMIC_RELEASE);
+}
+
+void rl_log_flush()
+{
+    unsigned int tail = __atomic_load_n(&g_log.tail, __ATOMIC_ACQUIRE);
+    if (    (tail == __atomic_load_n(&g_log.head, __ATOMIC_ACQUIRE))
+         && (0 == __atomic_load_n(&g_log.dropped, __ATOMIC_RELAXED))
+       )
     {
-        PROC_ERROR("stat() failure");
-        return NULL;
+        return;
     }
 
-    if (0 > snprintf(name, maxLen, SHARED_MEM_FORMAT, type, statBuffer.st_dev, statBuffer.st_ino))
+    int idle = 0;
+    if (!__atomic_compare_exchange_n(&g_log.flushing, &idle, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
     {
-        PROC_ERROR("name formatting error! not enough space?");
-        return NULL;
+        return; //another thread is flushing
     }
-    return true;
-}
 
+    int savedErrno = errno;
 
-static bool make_shared_name_by_fd(int fd, char type, char *name, size_t maxLen)
-{
-    int returnValue = -1;
-    struct stat statBuffer;
-    
-    if (!name)
+    tail = __atomic_load_n(&g_log.tail, __ATOMIC_ACQUIRE);
+    while (tail != __atomic_load_n(&g_log.head, __ATOMIC_ACQUIRE))
     {
-        PROC_ERROR("wrong arguments");
-        return false;
-    }
+        rl_log_entry *entry = &g_log.entries[tail & (RL_LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != tail + 1)
+        {
+            break; //still being written, next flush will take it
+        }
 
-    returnValue = fstat(fd, &statBuffer);
-    if (returnValue < 0)
-    {
-        PROC_ERROR("stat() failure");
-        return NULL;
+        fprintf((entry->level <= RL_LOG_WARN) ? stderr : stdout, "[%d] %s\n", current_pid(), entry->msg);
+        tail++;
+        __atomic_store_n(&g_log.tail, tail, __ATOMIC_RELEASE);
     }
- 
-    if (0 > snprintf(name, maxLen, SHARED_MEM_FORMAT, type, statBuffer.st_dev, statBuffer.st_ino))
+
+    unsigned int dropped = __atomic_exchange_n(&g_log.dropped, 0, __ATOMIC_RELAXED);
+    if (dropped)
     {
-        PROC_ERROR("name formatting error! not enough space?");
-        return NULL;
+        fprintf(stderr, "[%d] %u log messages dropped\n", current_pid(), dropped);
     }
-    return true;
-}
 
+    __atomic_store_n(&g_log.flushing, 0, __ATOMIC_RELEASE);
+    errno = savedErrno;
+}
 
-static bool is_owners_are_equal(owner o1, owner o2){
-    return ((o1.des == o2.des) && (o1.proc == o2.proc));
+static void log_reset_after_fork()
+{
+    g_log.tail     = g_log.head;
+    g_log.dropped  = 0;
+    g_log.flushing = 0;
 }
 
+//==============================================================================================================
+// registry: the top bits of the (dev, ino) hash select the shard, the low bits the bucket of the shard.
 
-static int can_add_new_owner(owner own, rl_open_file *f){
-    int ind = f->first;
-    int res = 0;
-    //ind can be NEXT_NULL(-2) or NEXT_LAST(-1)
-    while(ind >= 0) { 
-        for(size_t i = 0; i < f->lock_table[ind].nb_owners; i++){
-            if(is_owners_are_equal(f->lock_table[ind].lock_owners[i], own)) {
-                if (f->lock_table[ind].nb_owners >= NB_OWNERS) { 
-                    return -1; 
-                }
-                res = 1;
-            }
-        }
-        ind = f->lock_table[ind].next_lock;
-    }
-    return res;
+static uint64_t registry_hash(dev_t dev, ino_t ino)
+{
+    uint64_t h = ((uint64_t)ino ^ ((uint64_t)dev << 32) ^ ((uint64_t)dev >> 32)) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+static rl_registry_shard *registry_shard(uint64_t hash)
+{
+    return &g_registry[hash >> (64 - __builtin_ctz(RL_REGISTRY_SHARDS))];
 }
 
-bool has_owner(rl_lock *l, owner *o)
+static int registry_grow(rl_registry_shard *shard)
 {
-    for(size_t i = 0; i < l->nb_owners; i++)
+    size_t          nbBuckets = (shard->nb_buckets) ? shard->nb_buckets * 2 : RL_REGISTRY_BUCKETS;
+    rl_file_entry **buckets   = calloc(nbBuckets, sizeof(rl_file_entry *));
+    if (!buckets)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < shard->nb_buckets; i++)
     {
-        if(is_owners_are_equal(l->lock_owners[i], *o))
+        rl_file_entry *entry = shard->buckets[i];
+        while (entry)
         {
-            return true;
+            rl_file_entry *next   = entry->next;
+            size_t         bucket = registry_hash(entry->dev, entry->ino) & (nbBuckets - 1);
+            entry->next      = buckets[bucket];
+            buckets[bucket]  = entry;
+            entry = next;
         }
     }
 
-    return false;
+    FREE_MEM(shard->buckets);
+    shard->buckets    = buckets;
+    shard->nb_buckets = nbBuckets;
+    return 0;
 }
 
+static rl_open_file *registry_find(dev_t dev, ino_t ino)
+{
+    uint64_t           hash  = registry_hash(dev, ino);
+    rl_registry_shard *shard = registry_shard(hash);
+    rl_open_file      *f     = NULL;
 
+    pthread_mutex_lock(&shard->mutex);
 
-static int add_new_owner(owner own, owner new_owner, rl_open_file *f)
-{
-    int ind = f->first;
-    //ind can be NEXT_NULL(-2) or NEXT_LAST(-1)
-    while(ind >= 0) 
+    if (shard->nb_buckets)
     {
-        if (f->lock_table[ind].type == F_RDLCK)
+        for (rl_file_entry *entry = shard->buckets[hash & (shard->nb_buckets - 1)]; entry; entry = entry->next)
         {
-            for(size_t i = 0; i < f->lock_table[ind].nb_owners; i++)
+            if ((entry->dev == dev) && (entry->ino == ino))
             {
-                if(is_owners_are_equal(f->lock_table[ind].lock_owners[i], own))
-                {
-                    if (!has_owner(&f->lock_table[ind], &new_owner))
-                    {
-                        f->lock_table[ind].lock_owners[f->lock_table[ind].nb_owners] = new_owner;
-                        f->lock_table[ind].nb_owners ++;
-                    }
-                }
+                //under the shard mutex, a close of the last descriptor can't unmap the file meanwhile
+                entry->refs++;
+                f = entry->f;
+                ref_add(f, 1);
+                break;
             }
         }
-        ind = f->lock_table[ind].next_lock;
     }
-    return 0;
+
+    pthread_mutex_unlock(&shard->mutex);
+    return f;
 }
 
-static int can_add_new_owner_by_pid(pid_t parent, rl_open_file *f)
+static rl_open_file *registry_acquire(rl_open_file *f)
 {
-    int ind = f->first;
-    
-    // loop through lock_table
-    //ind can be NEXT_NULL(-2) or NEXT_LAST(-1)
-    while(ind >= 0){ 
-        // loop through lock_owners
-        for(size_t i = 0; i < f->lock_table[ind].nb_owners; i++){
-            if(f->lock_table[ind].lock_owners[i].proc == parent 
-            && f->lock_table[ind].nb_owners >= NB_OWNERS) {
-                return -1;
-            }
-            
-        }
-        ind = f->lock_table[ind].next_lock;
-    }
-    return 0;
-}
+    uint64_t           hash  = registry_hash(f->dev, f->ino);
+    rl_registry_shard *shard = registry_shard(hash);
+    rl_open_file      *ret   = NULL;
 
-static int add_new_owner_by_pid(pid_t parent, pid_t fils, rl_open_file *f){
-    int ind = f->first;
-    int res = 0;
-    while(ind >= 0)
+    pthread_mutex_lock(&shard->mutex);
+
+    if ((shard->nb_entries >= shard->nb_buckets) && (0 != registry_grow(shard)) && (!shard->nb_buckets))
     {
-        if (f->lock_table[ind].type == F_RDLCK)
-        {
-            for(size_t i = 0; i < f->lock_table[ind].nb_owners; i++)
-            {
-                if(f->lock_table[ind].lock_owners[i].proc == parent)
-                {
-                    if (f->lock_table[ind].nb_owners < NB_OWNERS) 
-                    {
-                        owner new_owner = {.des = f->lock_table[ind].lock_owners[i].des, .proc = fils};
-
-                        if (!has_owner(&f->lock_table[ind], &new_owner))
-                        {
-                            f->lock_table[ind].lock_owners[f->lock_table[ind].nb_owners] = new_owner;
-                            f->lock_table[ind].nb_owners ++;
-                        }
-                    }
-                    else 
-                    {
-                        PROC_ERROR("add_new_owner_by_pid() failure NB_OWNERS at max");
-                        res = -1;
-                    }
-                }
-            }
-        }
-        ind = f->lock_table[ind].next_lock;
+        goto lExit;
     }
-    return res;
-}
 
-static void delete_owner(rl_open_file *f, int index, int d)
-{
-    for (int i = 0; i < f->lock_table[index].nb_owners; i++)
+    rl_file_entry **head  = &shard->buckets[hash & (shard->nb_buckets - 1)];
+    rl_file_entry  *entry = *head;
+    while ((entry) && ((entry->dev != f->dev) || (entry->ino != f->ino)))
     {
-        if (    (f->lock_table[index].lock_owners[i].proc == getpid())   //if this proc has lock.s for this fd
-             && (f->lock_table[index].lock_owners[i].des  == d)
-           )
-        {
-            if ((i+1) < f->lock_table[index].nb_owners)
-            {
-                memmove(&f->lock_table[index].lock_owners[i],    // erase him from owners and shift left the rest
-                        &f->lock_table[index].lock_owners[i+1],
-                        sizeof(owner) * (f->lock_table[index].nb_owners - (i+1)) );
-                i--;
-            }
-            f->lock_table[index].nb_owners--;    
-        }
+        entry = entry->next;
     }
 
-    if (!f->lock_table[index].nb_owners)
+    if (entry)
     {
-        delete_lock(f, index);
+        entry->refs++;
+        ret = entry->f;
+        goto lExit;
     }
-}
 
-static void delete_lock(rl_open_file *f, int index)
-{
-    int prevIdx = NEXT_NULL;
-    int lockIdx = f->first;
-    while (lockIdx >= 0)
+    entry = malloc(sizeof(rl_file_entry));
+    if (!entry)
     {
-        if (index == lockIdx)
-        {
-            if (prevIdx != NEXT_NULL)
-            {
-                f->lock_table[prevIdx].next_lock = f->lock_table[lockIdx].next_lock;
-            }
-            else 
-            {
-                f->first = f->lock_table[lockIdx].next_lock;    
-            }
+        goto lExit;
+    }
 
-            f->lock_table[lockIdx].nb_owners       = 0;
-            f->lock_table[lockIdx].next_lock       = NEXT_NULL;
-            f->lock_table[lockIdx].len             = 0;
-            f->lock_table[lockIdx].starting_offset = 0;
-            f->lock_table[lockIdx].type            = 0;
-            return;
-        }
+    entry->dev  = f->dev;
+    entry->ino  = f->ino;
+    entry->f    = f;
+    entry->refs = 1;
+    entry->next = *head;
+    *head = entry;
+    shard->nb_entries++;
+    ret = f;
 
-        prevIdx = lockIdx;
-        lockIdx = f->lock_table[lockIdx].next_lock;    
-    }
+lExit:
+    pthread_mutex_unlock(&shard->mutex);
+    return ret;
 }
+static int registry_release(rl_open_file *f, int *sharedRefs)
+{
+    uint64_t           hash  = registry_hash(f->dev, f->ino);
+    rl_registry_shard *shard = registry_shard(hash);
+    int                refs  = -1;
 
+    pthread_mutex_lock(&shard->mutex);
 
+    *sharedRefs = ref_release(f);
 
-static uint64_t get_file_size(int fd)
-{
-    struct stat l_sStat;
-    l_sStat.st_size = 0;
-    if (0 == fstat(fd, &l_sStat))
+    if (shard->nb_buckets)
     {
-        return (uint64_t)l_sStat.st_size;
+        for (rl_file_entry **link = &shard->buckets[hash & (shard->nb_buckets - 1)]; *link; link = &(*link)->next)
+        {
+            rl_file_entry *entry = *link;
+            if ((entry->dev == f->dev) && (entry->ino == f->ino))
+            {
+                refs = --entry->refs;
+                if (refs <= 0)
+                {
+                    *link = entry->next;
+                    free(entry);
+                    shard->nb_entries--;
+                }
+                break;
+            }
+        }
     }
 
-    return 0;
+    pthread_mutex_unlock(&shard->mutex);
+    return refs;
 }
-
-static uint64_t get_current_position(int fd)
+static void registry_lock_all()
 {
-    return (uint64_t)lseek(fd, 0, SEEK_CUR);    
+    for (int i = 0; i < RL_REGISTRY_SHARDS; i++)
+    {
+        pthread_mutex_lock(&g_registry[i].mutex);
+    }
 }
 
-static bool is_region_intersection(off_t offset, off_t len, rl_lock *lck)
+static void registry_unlock_all()
 {
-    if ((offset >= lck->starting_offset) && (offset < (lck->starting_offset + lck->len))) return true;
-    if (((offset + len) > lck->starting_offset) && ((offset + len) <= (lck->starting_offset + lck->len))) return true;
-    if ((offset <= lck->starting_offset) && ((offset + len) >= (lck->starting_offset + lck->len))) return true;
-
-    return false;
+    for (int i = RL_REGISTRY_SHARDS - 1; i >= 0; i--)
+    {
+        pthread_mutex_unlock(&g_registry[i].mutex);
+    }
 }
 
-static bool is_region_intersection_or_neighbour(off_t offset, off_t len, rl_lock *lck)
+static void fork_lock_registry()
 {
-    if ((offset >= lck->starting_offset) && (offset <= (lck->starting_offset + lck->len))) return true;
-    if (((offset + len) >= lck->starting_offset) && ((offset + len) <= (lck->starting_offset + lck->len))) return true;
-    if ((offset <= lck->starting_offset) && ((offset + len) >= (lck->starting_offset + lck->len))) return true;
-
-    return false;
+    if (!g_is_forking)
+    {
+        registry_lock_all();
+    }
 }
 
-static bool is_region_equal(off_t offset, off_t len, rl_lock *lck)
+static void fork_unlock_registry()
 {
-    return (offset == lck->starting_offset) && (len == lck->len);
+    if (!g_is_forking)
+    {
+        registry_unlock_all();
+    }
 }
 
-static bool is_rl_compatible(rl_descriptor lfd, struct flock *lck)
+static rl_open_file *registry_visit(bool (*visit)(rl_file_entry *entry, int arg), int arg)
 {
-    int lockIdx = lfd.f->first;
-    while (lockIdx >= 0)
+    for (int i = 0; i < RL_REGISTRY_SHARDS; i++)
     {
-        if (    (is_region_intersection(lck->l_start, lck->l_len, &lfd.f->lock_table[lockIdx]))
-             && (is_other_owner(lfd.d, &lfd.f->lock_table[lockIdx]))
-           )
+        for (size_t bucket = 0; bucket < g_registry[i].nb_buckets; bucket++)
         {
-            if (lck->l_type == F_WRLCK)    
-            {
-                return false;
-            }
-            if ((lck->l_type == F_RDLCK) && (lfd.f->lock_table[lockIdx].type == F_WRLCK))
+            for (rl_file_entry *entry = g_registry[i].buckets[bucket]; entry; entry = entry->next)
             {
-                return false;
+                if (!visit(entry, arg))
+                {
+                    return entry->f;
+                }
             }
         }
-
-        lockIdx = lfd.f->lock_table[lockIdx].next_lock;    
     }
+    return NULL;
+}
 
+static bool fork_reference(rl_file_entry *entry, int nb)
+{
+    ref_add(entry->f, nb * entry->refs);
+    RL_DEBUG("[%d] Fork: RC : %d", current_pid(), entry->f->refCnt);
     return true;
 }
 
+static bool fork_reserve(rl_file_entry *entry, int parent)
+{
+    rl_open_file *f = entry->f;
+
+    //there is nothing to inherit if the table and fast slots are empty
+    //only the parent's threads change its locks, the fast path and other processes are left alone otherwise
+    return (!has_read_locks(f, parent)) || (reserve_inheritance(f, parent));
+}
 
-static bool is_owner(int d, rl_lock *lck)
+static bool fork_complete(rl_file_entry *entry, int child)
 {
-    pid_t curPid = getpid();
-    for (size_t szI = 0; szI < lck->nb_owners; szI ++)    
+    if (__atomic_load_n(&entry->f->nb_inherits, __ATOMIC_ACQUIRE))
     {
-        if ((lck->lock_owners[szI].des == d) && (lck->lock_owners[szI].proc == curPid)) return true;
+        complete_inheritance(entry->f, current_pid(), child);
     }
-
-    return false;
+    return true;
 }
 
-static bool is_other_owner(int d, rl_lock *lck)
+//==============================================================================================================
+// snapshot reads: the mutex holder keeps f->seq odd while it may change the table. A reader walks the interval
+// index between two reads of an even, unchanged seq; every index it follows is checked, so a walk that met a
+// change in progress ends early and is discarded.
+
+static bool snapshot_owner_conflict(rl_open_file *f, owner own, rl_lock *lck, pid_t *pid)
 {
-    pid_t curPid = getpid();
-    for (size_t szI = 0; szI < lck->nb_owners; szI ++)    
+    int ownIdx = __atomic_load_n(&lck->owners, __ATOMIC_RELAXED);
+    for (int steps = 0; (ownIdx >= 0) && (steps < f->owner_pool.nb_slots); steps++)
     {
-        if ((lck->lock_owners[szI].des != d) || (lck->lock_owners[szI].proc != curPid)) return true;
+        rl_owner *o = pool_slot_checked(f, &f->owner_pool, ownIdx);
+        if (!o)
+        {
+            return false;
+        }
+        if (!is_owners_are_equal(o->own, own))
+        {
+            *pid = o->own.proc;
+            return true;
+        }
+        ownIdx = __atomic_load_n(&o->next, __ATOMIC_RELAXED);
     }
-
     return false;
 }
 
-static void rl_clear_dead_owners(rl_descriptor lfd)
+static int collect_conflicts(rl_open_file *f, owner own, const struct flock *lck, struct flock *conflicts, size_t max)
 {
-    int lockIdx = lfd.f->first;
-    while (lockIdx >= 0)
+    off_t  start = lck->l_start;
+    off_t  end   = lck->l_start + lck->l_len;
+    size_t nb    = 0;
+    int    stack[RL_SNAPSHOT_DEPTH];
+    int    depth = 0;
+    int    node  = __atomic_load_n(&f->root, __ATOMIC_RELAXED);
+    int    steps = 0;
+    int    limit = __atomic_load_n(&f->lock_pool.nb_slots, __ATOMIC_RELAXED) * 2 + 1;
+
+    //in order walk, subtrees ending before start are skipped, the walk stops at the first lock beginning after end
+    while ((nb < max) && ((node >= 0) || (depth > 0)))
     {
-        for (int i = 0; i < lfd.f->lock_table[lockIdx].nb_owners; i++)
+        while (node >= 0)
         {
-            if (0 != kill(lfd.f->lock_table[lockIdx].lock_owners[i].proc, 0)) //process is dead
+            rl_lock *l = pool_slot_checked(f, &f->lock_pool, node);
+            if ((!l) || (depth == RL_SNAPSHOT_DEPTH) || (++steps > limit))
             {
-                if ((i+1) < lfd.f->lock_table[lockIdx].nb_owners)
-                {
-                    memmove(&lfd.f->lock_table[lockIdx].lock_owners[i],    // erase him from owners and shift left the rest
-                            &lfd.f->lock_table[lockIdx].lock_owners[i+1],
-                            sizeof(owner) * (lfd.f->lock_table[lockIdx].nb_owners - (i+1)) );
-                    i--;
-                }
-                lfd.f->lock_table[lockIdx].nb_owners--;    
+                return -1;
+            }
+            if (l->max_end <= start)
+            {
+                break;
             }
+            stack[depth++] = node;
+            node = __atomic_load_n(&l->left, __ATOMIC_RELAXED);
         }
 
-        if (!lfd.f->lock_table[lockIdx].nb_owners) //if there is no more owners for lock -> remove lock from lock_table
+        if (depth == 0)
         {
-            int nextLock = lfd.f->lock_table[lockIdx].next_lock;
-            lfd.f->lock_table[lockIdx].next_lock = NEXT_NULL;
-            
-            if (lfd.f->first == lockIdx)
-            {
-                lfd.f->first = nextLock;
-            }
-            lockIdx = nextLock;
+            break;
         }
-        else
+
+        rl_lock *l = pool_slot_checked(f, &f->lock_pool, stack[--depth]);
+        if (!l)
+        {
+            return -1;
+        }
+        if (l->starting_offset >= end)
+        {
+            break;
+        }
+
+        pid_t pid = 0;
+        if (    (lock_end(l) > start)
+             && ((lck->l_type == F_WRLCK) || (l->type == F_WRLCK))
+             && (snapshot_owner_conflict(f, own, l, &pid))
+           )
         {
-            lockIdx = lfd.f->lock_table[lockIdx].next_lock;    
+            conflicts[nb].l_type   = l->type;
+            conflicts[nb].l_whence = SEEK_SET;
+            conflicts[nb].l_start  = l->starting_offset;
+            conflicts[nb].l_len    = range_flock_len(l->starting_offset, l->len);
+            conflicts[nb].l_pid    = pid;
+            nb++;
         }
+        node = __atomic_load_n(&l->right, __ATOMIC_RELAXED);
     }
-}
 
-static int add_owner(rl_descriptor lfd, rl_lock *lck)
-{
-    if (lck->nb_owners >= NB_OWNERS)
+    //fast locks are read locks, they only conflict with a write request
+    for (int i = 0; (lck->l_type == F_WRLCK) && (nb < max) && (i < RL_FAST_SLOTS); i++)
     {
-        PROC_ERROR("Lock is full");
-        errno = EAGAIN;
-        return -1;
-    }
+        rl_fast_lock *fast = &f->fast_locks[i];
+        if (RL_FAST_HELD != __atomic_load_n(&fast->state, __ATOMIC_ACQUIRE))
+        {
+            continue;
+        }
 
-    owner o;
-    o.des = lfd.d;
-    o.proc = getpid();
+        struct flock found = {.l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = fast->start, .l_len = fast->len, .l_pid = fast->own.proc};
+        off_t        end2  = found.l_start + found.l_len;
+        bool         isOther = !is_owners_are_equal(fast->own, own);
 
-    if (!has_owner(lck, &o))
-    {
-        lck->lock_owners[lck->nb_owners] = o;
-        lck->nb_owners ++;
+        //the slot may have been released and taken again while it was read
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (RL_FAST_HELD != __atomic_load_n(&fast->state, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+
+        if ((isOther) && (range_overlaps(start, end, found.l_start, end2)))
+        {
+            found.l_len     = range_flock_len(found.l_start, found.l_len);
+            conflicts[nb++] = found;
+        }
     }
 
-    return 0;
+    return (int)nb;
 }
 
-static int add_lock(rl_open_file *f, struct flock *lck, int d, int type)
+static int snapshot_conflicts(rl_open_file *f, owner own, const struct flock *lck, struct flock *conflicts, size_t max)
 {
-    for (size_t szI = 0; szI < NB_LOCKS; szI ++)
+    for (int attempt = 0; attempt < RL_SNAPSHOT_RETRIES; attempt++)
     {
-        if (f->lock_table[szI].len == 0)
+        unsigned int seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1u)
         {
-            f->lock_table[szI].next_lock           = f->first;
-            f->lock_table[szI].starting_offset     = lck->l_start;
-            f->lock_table[szI].len                 = lck->l_len;
-            f->lock_table[szI].type                = type;
-            f->lock_table[szI].lock_owners[0].proc = getpid();
-            f->lock_table[szI].lock_owners[0].des  = d;
-            f->lock_table[szI].nb_owners           = 1;
+            sched_yield();
+            continue;
+        }
 
-            f->first = szI;
-            return 0;
+        int nb = collect_conflicts(f, own, lck, conflicts, max);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((nb >= 0) && (seq == __atomic_load_n(&f->seq, __ATOMIC_RELAXED)))
+        {
+            return nb;
         }
     }
 
-    PROC_ERROR("Lock has no free space");
+    //queries never take the file mutex, the caller decides when to try again
     errno = EAGAIN;
     return -1;
 }
 
-static int add_read_lock_region(rl_descriptor lfd, struct flock *lck)
+static bool has_read_locks(rl_open_file *f, pid_t pid)
 {
-    //search for exact segment
-    int lockIdx = lfd.f->first;
-    while (lockIdx >= 0)
+    if (has_fast_locks(f, pid))
     {
-        if (is_region_equal(lck->l_start, lck->l_len, &lfd.f->lock_table[lockIdx]))
-        {
-            if (is_owner(lfd.d, &lfd.f->lock_table[lockIdx]))
-            {
-                return 0;
-            }
-            else
-            {
-                return add_owner(lfd, &lfd.f->lock_table[lockIdx]);
-            }
-        }
-        lockIdx = lfd.f->lock_table[lockIdx].next_lock;    
+        return true;
     }
 
-    //search for all intersections where lfd is owner
-    lockIdx = lfd.f->first;
-    while (lockIdx >= 0)
+    for (int attempt = 0; attempt < RL_SNAPSHOT_RETRIES; attempt++)
     {
-        if (    (is_region_intersection_or_neighbour(lck->l_start, lck->l_len, &lfd.f->lock_table[lockIdx]))
-             && (is_owner(lfd.d, &lfd.f->lock_table[lockIdx]))
-           )
+        unsigned int seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1u)
         {
-            off_t newStart = MIN(lck->l_start, lfd.f->lock_table[lockIdx].starting_offset);
-            off_t newEnd1  = lck->l_start + lck->l_len;
-            off_t newEnd2  = lfd.f->lock_table[lockIdx].starting_offset + lfd.f->lock_table[lockIdx].len;
-            off_t newLen   = MAX(newEnd1, newEnd2) - newStart; 
+            sched_yield();
+            continue;
+        }
 
-            lck->l_start = newStart;
-            lck->l_len   = newLen;
+        bool isFound  = false;
+        bool isBroken = false;
+        int  steps    = 0;
+        int  ownSteps = 0;
+        int  limit    = __atomic_load_n(&f->lock_pool.nb_slots, __ATOMIC_RELAXED) + 1;
+        int  ownLimit = __atomic_load_n(&f->owner_pool.nb_slots, __ATOMIC_RELAXED) + 1;
+        for (int lockIdx = __atomic_load_n(&f->first, __ATOMIC_RELAXED); (lockIdx >= 0) && (!isFound) && (!isBroken); )
+        {
+            rl_lock *l = pool_slot_checked(f, &f->lock_pool, lockIdx);
+            if ((!l) || (++steps > limit))
+            {
+                isBroken = true;
+                break;
+            }
 
-            int nextIdx = lfd.f->lock_table[lockIdx].next_lock;    
-            delete_owner(lfd.f, lockIdx, lfd.d);
-            lockIdx = nextIdx;
+            for (int ownIdx = __atomic_load_n(&l->owners, __ATOMIC_RELAXED); (ownIdx >= 0) && (l->type == F_RDLCK); )
+            {
+                rl_owner *o = pool_slot_checked(f, &f->owner_pool, ownIdx);
+                if ((!o) || (++ownSteps > ownLimit))
+                {
+                    isBroken = true;
+                    break;
+                }
+                if (o->own.proc == pid)
+                {
+                    isFound = true;
+                    break;
+                }
+                ownIdx = __atomic_load_n(&o->next, __ATOMIC_RELAXED);
+            }
+            lockIdx = __atomic_load_n(&l->next_lock, __ATOMIC_RELAXED);
         }
-        else
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((!isBroken) && (seq == __atomic_load_n(&f->seq, __ATOMIC_RELAXED)))
         {
-            lockIdx = lfd.f->lock_table[lockIdx].next_lock;    
+            return isFound;
         }
     }
 
-    return add_lock(lfd.f, lck, lfd.d, F_RDLCK);
+    //a useless reservation only costs the next mutex holder a walk of the table
+    return true;
 }
 
-static int add_write_lock_region(rl_descriptor lfd, struct flock *lck)
+static void load_stats(rl_open_file *f, struct rl_stats *stats)
 {
-    int lockIdx = lfd.f->first;
-    while (lockIdx >= 0)
+    struct rl_stats *shared = &f->stats;
+    stats->acquisitions     = __atomic_load_n(&shared->acquisitions, __ATOMIC_RELAXED);
+    stats->conflicts        = __atomic_load_n(&shared->conflicts, __ATOMIC_RELAXED);
+    stats->waits            = __atomic_load_n(&shared->waits, __ATOMIC_RELAXED);
+    stats->wait_ns          = __atomic_load_n(&shared->wait_ns, __ATOMIC_RELAXED);
+    stats->max_wait_ns      = __atomic_load_n(&shared->max_wait_ns, __ATOMIC_RELAXED);
+    stats->wakeups          = __atomic_load_n(&shared->wakeups, __ATOMIC_RELAXED);
+    stats->spurious_wakeups = __atomic_load_n(&shared->spurious_wakeups, __ATOMIC_RELAXED);
+    stats->timeouts         = __atomic_load_n(&shared->timeouts, __ATOMIC_RELAXED);
+    stats->merges           = __atomic_load_n(&shared->merges, __ATOMIC_RELAXED);
+    stats->splits           = __atomic_load_n(&shared->splits, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
     {
-        if (    (    (    (is_region_intersection_or_neighbour(lck->l_start, lck->l_len, &lfd.f->lock_table[lockIdx]))
-                       && (lfd.f->lock_table[lockIdx].type == lck->l_type)
-                     )
-                  || (is_region_intersection(lck->l_start, lck->l_len, &lfd.f->lock_table[lockIdx]))
-                ) 
-             && (is_owner(lfd.d, &lfd.f->lock_table[lockIdx]))
-           )
-        {
-            off_t newStart = MIN(lck->l_start, lfd.f->lock_table[lockIdx].starting_offset);
-            off_t newEnd1  = lck->l_start + lck->l_len;
-            off_t newEnd2  = lfd.f->lock_table[lockIdx].starting_offset + lfd.f->lock_table[lockIdx].len;
-            off_t newLen   = MAX(newEnd1, newEnd2) - newStart; 
-
-            lck->l_start = newStart;
-            lck->l_len   = newLen;
-
-            int nextIdx = lfd.f->lock_table[lockIdx].next_lock;    
-            delete_owner(lfd.f, lockIdx, lfd.d);
-            lockIdx = nextIdx;
-        }
-        else
-        {
-            lockIdx = lfd.f->lock_table[lockIdx].next_lock;    
-        }
+        stats->acquisitions += __atomic_load_n(&f->fast_locks[i].acquisitions, __ATOMIC_RELAXED);
     }
+}
 
-    return add_lock(lfd.f, lck, lfd.d, F_WRLCK);
+static void snapshot_add(rl_snapshot_entry *entries, size_t max, size_t *nb, short kind, short type, 
+                         off_t start, off_t len, owner own)
+{
+    if (*nb < max)
+    {
+        entries[*nb] = (rl_snapshot_entry){.kind  = kind, 
+                                           .type  = type, 
+                                           .start = start, 
+                                           .len   = range_flock_len(start, len),
+                                           .pid   = own.proc, 
+                                           .des   = own.des, 
+                                           .token = own.token};
+    }
+    (*nb)++;
 }
 
-static int delete_lock_region(rl_descriptor lfd, struct flock *lck)
+static ssize_t collect_snapshot(rl_open_file *f, struct rl_snapshot *head, rl_snapshot_entry *entries, size_t max)
 {
-    int lockIdx = lfd.f->first;
+    size_t nb        = 0;
+    int    steps     = 0;
+    int    lockLimit = __atomic_load_n(&f->lock_pool.nb_slots, __ATOMIC_RELAXED) + 1;
+    int    ownLimit  = __atomic_load_n(&f->owner_pool.nb_slots, __ATOMIC_RELAXED) + 1;
+    int    waitLimit = __atomic_load_n(&f->waiter_pool.nb_slots, __ATOMIC_RELAXED) + 1;
+
+    head->dev     = f->dev;
+    head->ino     = f->ino;
+    head->version = f->version;
+    head->creator = f->creator;
+    head->refs    = __atomic_load_n(&f->refCnt, __ATOMIC_RELAXED);
+    head->policy  = __atomic_load_n(&f->policy, __ATOMIC_RELAXED);
+    load_stats(f, &head->stats);
+
+    //locks in offset order, an entry per owner; each owner belongs to a single lock, so owners are counted together
+    int ownSteps = 0;
+    int lockIdx  = __atomic_load_n(&f->first, __ATOMIC_RELAXED);
     while (lockIdx >= 0)
     {
-        if (    (is_region_intersection(lck->l_start, lck->l_len, &lfd.f->lock_table[lockIdx]))
-             && (is_owner(lfd.d, &lfd.f->lock_table[lockIdx]))
-           )
+        rl_lock *l = pool_slot_checked(f, &f->lock_pool, lockIdx);
+        if ((!l) || (++steps > lockLimit))
         {
-            off_t unlStart = lck->l_start;
-            off_t unlEnd   = lck->l_start + lck->l_len;
-            off_t lckStart = lfd.f->lock_table[lockIdx].starting_offset;
-            off_t lckEnd   = lfd.f->lock_table[lockIdx].starting_offset + lfd.f->lock_table[lockIdx].len;
+            return -1;
+        }
 
-            //if lock region is include in unlock region
-            if ((unlStart <= lckStart) && (unlEnd >= lckEnd))
+        int ownIdx = __atomic_load_n(&l->owners, __ATOMIC_RELAXED);
+        while (ownIdx >= 0)
+        {
+            rl_owner *o = pool_slot_checked(f, &f->owner_pool, ownIdx);
+            if ((!o) || (++ownSteps > ownLimit))
             {
-                int nextIdx = lfd.f->lock_table[lockIdx].next_lock;    
-                delete_owner(lfd.f, lockIdx, lfd.d);
-                lockIdx = nextIdx;
+                return -1;
             }
-            //unlock region is include in lock region -> remove owner, make 2 and start from beginning because we add
-            //new region to head
-            else if ((unlStart > lckStart) && (unlEnd < lckEnd))
-            {
-                struct flock lckLeft  = *lck;
-                struct flock lckRight = *lck;
-                lckLeft.l_start = lckStart;
-                lckLeft.l_len   = unlStart - lckStart;
+            snapshot_add(entries, max, &nb, RL_SNAPSHOT_LOCK, l->type, l->starting_offset, l->len, o->own);
+            ownIdx = __atomic_load_n(&o->next, __ATOMIC_RELAXED);
+        }
+        lockIdx = __atomic_load_n(&l->next_lock, __ATOMIC_RELAXED);
+    }
 
-                lckRight.l_start = unlEnd;
-                lckRight.l_len   = lckEnd - unlEnd;
+    //fast locks aren't covered by f->seq, a slot is kept only if it is still held once read
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
+    {
+        rl_fast_lock *fast = &f->fast_locks[i];
+        if (RL_FAST_HELD != __atomic_load_n(&fast->state, __ATOMIC_ACQUIRE))
+        {
+            continue;
+        }
 
-                if (    (0 != add_lock(lfd.f, &lckLeft,  lfd.d, lfd.f->lock_table[lockIdx].type))
-                     || (0 != add_lock(lfd.f, &lckRight, lfd.d, lfd.f->lock_table[lockIdx].type))
-                   )
-                {
-                    return -1;
-                }
+        owner own   = fast->own;
+        off_t start = fast->start;
+        off_t len   = fast->len;
 
-                delete_owner(lfd.f, lockIdx, lfd.d);
-                lockIdx = lfd.f->first;
-            }
-            //unlock region has right intersection with lock region, remove owner, split and start from beginning because we add
-            //new region to head
-            else if ((unlStart <= lckStart) && (unlEnd <= lckEnd))
-            {
-                struct flock lckRight  = *lck;
-                lckRight.l_start = unlEnd;
-                lckRight.l_len   = lckEnd - unlEnd;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (RL_FAST_HELD == __atomic_load_n(&fast->state, __ATOMIC_RELAXED))
+        {
+            snapshot_add(entries, max, &nb, RL_SNAPSHOT_FAST, F_RDLCK, start, len, own);
+        }
+    }
 
-                if (0 != add_lock(lfd.f, &lckRight, lfd.d, lfd.f->lock_table[lockIdx].type))
-                {
-                    return -1;
-                }
+    steps = 0;
+    int waiterIdx = __atomic_load_n(&f->first_waiter, __ATOMIC_RELAXED);
+    while (waiterIdx >= 0)
+    {
+        rl_waiter *w = pool_slot_checked(f, &f->waiter_pool, waiterIdx);
+        if ((!w) || (++steps > waitLimit))
+        {
+            return -1;
+        }
+        snapshot_add(entries, max, &nb, RL_SNAPSHOT_WAITER, w->type, w->start, w->len, w->own);
+        waiterIdx = __atomic_load_n(&w->next, __ATOMIC_RELAXED);
+    }
 
-                delete_owner(lfd.f, lockIdx, lfd.d);
-                lockIdx = lfd.f->first;
-            }            
-            //unlock region has right intersection with lock region, remove owner, split and start from beginning because we add
-            //new region to head
-            else if ((unlStart >= lckStart) && (unlEnd >= lckEnd))
-            {
-                struct flock lckLeft  = *lck;
-                lckLeft.l_start = lckStart;
-                lckLeft.l_len   = unlStart - lckStart;
+    return (ssize_t)nb;
+}
 
-                if (0 != add_lock(lfd.f, &lckLeft, lfd.d, lfd.f->lock_table[lockIdx].type))
-                {
-                    return -1;
-                }
+static ssize_t snapshot_file(rl_open_file *f, void *buffer, size_t size)
+{
+    struct rl_snapshot  head;
+    size_t              max     = (size > sizeof(head)) ? (size - sizeof(head)) / sizeof(rl_snapshot_entry) : 0;
+    rl_snapshot_entry  *entries = (max) ? ((struct rl_snapshot *)buffer)->entries : NULL;
 
-                delete_owner(lfd.f, lockIdx, lfd.d);
-                lockIdx = lfd.f->first;
-            }            
+    for (int attempt = 0; attempt < RL_SNAPSHOT_RETRIES; attempt++)
+    {
+        unsigned int seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1u)
+        {
+            sched_yield();
+            continue;
         }
-        else
+
+        memset(&head, 0, sizeof(head));
+        ssize_t nb = collect_snapshot(f, &head, entries, max);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((nb >= 0) && (seq == __atomic_load_n(&f->seq, __ATOMIC_RELAXED)))
         {
-            lockIdx = lfd.f->lock_table[lockIdx].next_lock;    
+            head.seq        = seq;
+            head.nb_entries = ((size_t)nb < max) ? (size_t)nb : max;
+            if (size >= sizeof(head))
+            {
+                memcpy(buffer, &head, sizeof(head));
+            }
+            return (ssize_t)(sizeof(head) + (size_t)nb * sizeof(rl_snapshot_entry));
         }
     }
 
-    return 0;
+    //monitoring never takes the file mutex, the caller decides when to try again
+    errno = EAGAIN;
+    return -1;
 }
-
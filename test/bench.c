@@ -0,0 +1,534 @@
+#include "rl_lock_library.h"
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+
+#define PROC_ERROR(Message) { fprintf(stderr, "%s : error {%s} in file {%s} on line {%d}\n", \
+                                                Message, strerror(errno), __FILE__, __LINE__); }\
+
+#define BENCH_ITERATIONS    100000
+#define BENCH_WORKERS       4
+#define BENCH_FORK_ROUNDS   200
+#define BENCH_MAX_WORKERS   64
+#define BENCH_MAX_RESULTS   32
+#define BENCH_OPEN_FLAGS    (S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH)
+
+/* log-linear histogram: values below 16ns are exact, above each power of two is split into 16 buckets (~6% error) */
+#define HIST_SUB_BITS       4
+#define HIST_SUB_COUNT      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        (64 * HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint64_t        counts[HIST_BUCKETS];
+    uint64_t        count;
+    uint64_t        sum;
+    uint64_t        min;
+    uint64_t        max;
+} bench_hist;
+
+typedef struct
+{
+    char            name[48];
+    int             workers;
+    uint64_t        ops;
+    uint64_t        elapsed;    /* wall time of the run, ns */
+    uint64_t        p50;
+    uint64_t        p99;
+    uint64_t        p999;
+    uint64_t        min;
+    uint64_t        max;
+    uint64_t        mean;
+} bench_result;
+
+/* shared with worker processes, one histogram per worker so recording never synchronizes */
+typedef struct
+{
+    pthread_barrier_t   start;
+    bench_hist          hists[BENCH_MAX_WORKERS];
+} bench_shared;
+
+typedef struct
+{
+    const char      *fileName;
+    bench_shared    *shared;
+    int             index;
+    long            iterations;
+    bool            isOk;
+} bench_worker;
+
+static bench_result g_results[BENCH_MAX_RESULTS];
+static int          g_nbResults = 0;
+
+//==============================================================================================================
+// histograms
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void hist_reset(bench_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline int hist_bucket(uint64_t value)
+{
+    if (value < HIST_SUB_COUNT)
+    {
+        return (int)value;
+    }
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exp - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+}
+
+/* largest value falling in the bucket, percentiles are reported as upper bounds */
+static uint64_t hist_bucket_value(int bucket)
+{
+    if (bucket < HIST_SUB_COUNT)
+    {
+        return (uint64_t)bucket;
+    }
+    int      exp   = bucket / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    uint64_t width = 1ull << (exp - HIST_SUB_BITS);
+    uint64_t low   = (uint64_t)(HIST_SUB_COUNT + bucket % HIST_SUB_COUNT) << (exp - HIST_SUB_BITS);
+    return low + width - 1;
+}
+
+static inline void hist_record(bench_hist *h, uint64_t value)
+{
+    h->counts[hist_bucket(value)]++;
+    h->count++;
+    h->sum += value;
+    h->min  = (value < h->min) ? value : h->min;
+    h->max  = (value > h->max) ? value : h->max;
+}
+
+static void hist_merge(bench_hist *to, const bench_hist *from)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        to->counts[i] += from->counts[i];
+    }
+    to->count += from->count;
+    to->sum   += from->sum;
+    to->min    = (from->min < to->min) ? from->min : to->min;
+    to->max    = (from->max > to->max) ? from->max : to->max;
+}
+
+static uint64_t hist_percentile(const bench_hist *h, double percentile)
+{
+    uint64_t rank = (uint64_t)(percentile * (double)h->count / 100.0);
+    uint64_t seen = 0;
+
+    rank = (rank < h->count) ? rank + 1 : h->count;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t value = hist_bucket_value(i);
+            return (value < h->max) ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void add_result(const char *name, int workers, const bench_hist *h, uint64_t elapsed)
+{
+    if ((g_nbResults >= BENCH_MAX_RESULTS) || (0 == h->count))
+    {
+        return;
+    }
+
+    bench_result *res = &g_results[g_nbResults++];
+    snprintf(res->name, sizeof(res->name), "%s", name);
+    res->workers = workers;
+    res->ops     = h->count;
+    res->elapsed = elapsed;
+    res->p50     = hist_percentile(h, 50.0);
+    res->p99     = hist_percentile(h, 99.0);
+    res->p999    = hist_percentile(h, 99.9);
+    res->min     = h->min;
+    res->max     = h->max;
+    res->mean    = h->sum / h->count;
+
+    fprintf(stderr, "%-28s %3d %10lu %14.0f %10lu %10lu %10lu %10lu\n", res->name, res->workers, res->ops,
+            (double)res->ops * 1e9 / (double)(elapsed ? elapsed : 1), res->mean, res->p50, res->p99, res->p999);
+}
+
+//==============================================================================================================
+// benchmarks
+
+static void init_lock(struct flock *lck, short type, off_t start, off_t len)
+{
+    lck->l_type   = type;
+    lck->l_whence = SEEK_SET;
+    lck->l_start  = start;
+    lck->l_len    = len;
+    lck->l_pid    = getpid();
+}
+
+/* lock and unlock of a region nobody else holds, samples the pair */
+static bool bench_uncontended(const char *fileName, const char *name, short type, long iterations, bench_hist *h)
+{
+    rl_descriptor lfd = rl_open(fileName, O_RDWR, BENCH_OPEN_FLAGS);
+    struct flock  lck;
+    struct flock  unlck;
+    bool          isOk = true;
+
+    if (NULL == lfd.f)
+    {
+        return false;
+    }
+
+    init_lock(&lck, type, 0, 10);
+    init_lock(&unlck, F_UNLCK, 0, 10);
+    hist_reset(h);
+
+    uint64_t begin = now_ns();
+    for (long i = 0; (isOk) && (i < iterations); i++)
+    {
+        uint64_t t0 = now_ns();
+        isOk = (0 == rl_fcntl(lfd, F_SETLK, &lck)) && (0 == rl_fcntl(lfd, F_SETLK, &unlck));
+        hist_record(h, now_ns() - t0);
+    }
+    add_result(name, 1, h, now_ns() - begin);
+
+    rl_close(lfd);
+    return isOk;
+}
+
+/* body of contended workers: blocking write lock of the same region, samples lock + unlock */
+static bool contended_loop(bench_worker *w)
+{
+    rl_descriptor lfd = rl_open(w->fileName, O_RDWR, BENCH_OPEN_FLAGS);
+    bench_hist   *h   = &w->shared->hists[w->index];
+    struct flock  lck;
+    struct flock  unlck;
+    bool          isOk = (NULL != lfd.f);
+
+    init_lock(&lck, F_WRLCK, 0, 10);
+    init_lock(&unlck, F_UNLCK, 0, 10);
+    hist_reset(h);
+
+    //wait for the others even after a failure, so nobody stays on the barrier
+    pthread_barrier_wait(&w->shared->start);
+    for (long i = 0; (isOk) && (i < w->iterations); i++)
+    {
+        uint64_t t0 = now_ns();
+        isOk = (0 == rl_fcntl(lfd, F_SETLKW, &lck)) && (0 == rl_fcntl(lfd, F_SETLK, &unlck));
+        hist_record(h, now_ns() - t0);
+    }
+
+    if (lfd.f)
+    {
+        rl_close(lfd);
+    }
+    return isOk;
+}
+
+static void *contended_thread(void *arg)
+{
+    bench_worker *w = arg;
+    w->isOk = contended_loop(w);
+    return NULL;
+}
+
+static void collect_workers(bench_shared *shared, int workers, bench_hist *h)
+{
+    hist_reset(h);
+    for (int i = 0; i < workers; i++)
+    {
+        hist_merge(h, &shared->hists[i]);
+    }
+}
+
+static bool bench_contended_threads(const char *fileName, bench_shared *shared, int workers, long iterations,
+                                    bench_hist *h)
+{
+    pthread_t    threads[BENCH_MAX_WORKERS];
+    bench_worker args[BENCH_MAX_WORKERS];
+    bool         isOk = true;
+
+    pthread_barrier_init(&shared->start, NULL, (unsigned)workers + 1);
+    for (int i = 0; i < workers; i++)
+    {
+        args[i] = (bench_worker){.fileName = fileName, .shared = shared, .index = i, .iterations = iterations};
+        if (0 != pthread_create(&threads[i], NULL, contended_thread, &args[i]))
+        {
+            PROC_ERROR("pthread_create failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&shared->start);
+    uint64_t begin = now_ns();
+    for (int i = 0; i < workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+        isOk = isOk && args[i].isOk;
+    }
+    uint64_t elapsed = now_ns() - begin;
+    pthread_barrier_destroy(&shared->start);
+
+    collect_workers(shared, workers, h);
+    add_result("contended_threads", workers, h, elapsed);
+    return isOk;
+}
+
+static bool bench_contended_processes(const char *fileName, bench_shared *shared, int workers, long iterations,
+                                      bench_hist *h)
+{
+    pthread_barrierattr_t attr;
+    pid_t                 pids[BENCH_MAX_WORKERS];
+    bool                  isOk = true;
+
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&shared->start, &attr, (unsigned)workers + 1);
+    pthread_barrierattr_destroy(&attr);
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (-1 == (pids[i] = rl_fork()))
+        {
+            PROC_ERROR("rl_fork failed");
+            exit(EXIT_FAILURE);
+        }
+        if (0 == pids[i])
+        {
+            bench_worker w = {.fileName = fileName, .shared = shared, .index = i, .iterations = iterations};
+            _exit(contended_loop(&w) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&shared->start);
+    uint64_t begin = now_ns();
+    for (int i = 0; i < workers; i++)
+    {
+        int status = 0;
+        isOk = isOk && (pids[i] == waitpid(pids[i], &status, 0)) && WIFEXITED(status) &&
+               (EXIT_SUCCESS == WEXITSTATUS(status));
+    }
+    uint64_t elapsed = now_ns() - begin;
+    pthread_barrier_destroy(&shared->start);
+
+    collect_workers(shared, workers, h);
+    add_result("contended_processes", workers, h, elapsed);
+    return isOk;
+}
+
+/* rl_open + rl_close, isJoin keeps another descriptor open so the shared object is joined instead of created */
+static bool bench_open_close(const char *fileName, bool isJoin, long iterations, bench_hist *h)
+{
+    rl_descriptor keeper = {.d = -1, .f = NULL};
+    bool          isOk   = true;
+
+    if ((isJoin) && (NULL == (keeper = rl_open(fileName, O_RDWR, BENCH_OPEN_FLAGS)).f))
+    {
+        return false;
+    }
+
+    hist_reset(h);
+    uint64_t begin = now_ns();
+    for (long i = 0; (isOk) && (i < iterations); i++)
+    {
+        uint64_t      t0  = now_ns();
+        rl_descriptor lfd = rl_open(fileName, O_RDWR, BENCH_OPEN_FLAGS);
+        isOk = (NULL != lfd.f) && (-1 != rl_close(lfd));
+        hist_record(h, now_ns() - t0);
+    }
+    add_result(isJoin ? "open_close_join" : "open_close_create", 1, h, now_ns() - begin);
+
+    if (keeper.f)
+    {
+        rl_close(keeper);
+    }
+    return isOk;
+}
+
+static bool bench_dup_close(const char *fileName, long iterations, bench_hist *h)
+{
+    rl_descriptor lfd  = rl_open(fileName, O_RDWR, BENCH_OPEN_FLAGS);
+    bool          isOk = true;
+
+    if (NULL == lfd.f)
+    {
+        return false;
+    }
+
+    hist_reset(h);
+    uint64_t begin = now_ns();
+    for (long i = 0; (isOk) && (i < iterations); i++)
+    {
+        uint64_t      t0  = now_ns();
+        rl_descriptor dup = rl_dup(lfd);
+        isOk = (NULL != dup.f) && (-1 != rl_close(dup));
+        hist_record(h, now_ns() - t0);
+    }
+    add_result("dup_close", 1, h, now_ns() - begin);
+
+    rl_close(lfd);
+    return isOk;
+}
+
+/* parent side of rl_fork while the descriptor holds 'held' disjoint read locks, children release them and exit */
+static bool bench_fork(const char *fileName, int held, long rounds, bench_hist *h)
+{
+    rl_descriptor lfd  = rl_open(fileName, O_RDWR, BENCH_OPEN_FLAGS);
+    struct flock  lck;
+    bool          isOk = true;
+    char          name[48];
+
+    if (NULL == lfd.f)
+    {
+        return false;
+    }
+
+    //gaps between the regions keep them from being merged
+    for (int i = 0; (isOk) && (i < held); i++)
+    {
+        init_lock(&lck, F_RDLCK, (off_t)i * 2, 1);
+        isOk = (0 == rl_fcntl(lfd, F_SETLK, &lck));
+    }
+
+    hist_reset(h);
+    uint64_t begin = now_ns();
+    for (long i = 0; (isOk) && (i < rounds); i++)
+    {
+        int      status = 0;
+        uint64_t t0     = now_ns();
+        pid_t    pid    = rl_fork();
+        if (0 == pid)
+        {
+            rl_close(lfd);
+            _exit(EXIT_SUCCESS);
+        }
+        hist_record(h, now_ns() - t0);
+        isOk = (-1 != pid) && (pid == waitpid(pid, &status, 0)) && WIFEXITED(status);
+    }
+    snprintf(name, sizeof(name), "fork_held_%d", held);
+    add_result(name, 1, h, now_ns() - begin);
+
+    rl_close(lfd);
+    return isOk;
+}
+
+//==============================================================================================================
+// output
+
+static bool write_json(FILE *out, long iterations, int workers)
+{
+    fprintf(out, "{\n  \"library\": \"rl_lock_library\",\n  \"layout_version\": %d,\n", RL_LAYOUT_VERSION);
+    fprintf(out, "  \"iterations\": %ld,\n  \"workers\": %d,\n  \"unit\": \"ns\",\n  \"benchmarks\": [\n",
+            iterations, workers);
+    for (int i = 0; i < g_nbResults; i++)
+    {
+        bench_result *res = &g_results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"workers\": %d, \"ops\": %lu, \"elapsed_ns\": %lu, "
+                     "\"ops_per_sec\": %.1f, \"latency_ns\": {\"min\": %lu, \"mean\": %lu, \"p50\": %lu, "
+                     "\"p99\": %lu, \"p999\": %lu, \"max\": %lu}}%s\n",
+                res->name, res->workers, res->ops, res->elapsed,
+                (double)res->ops * 1e9 / (double)(res->elapsed ? res->elapsed : 1),
+                res->min, res->mean, res->p50, res->p99, res->p999, res->max, (i + 1 < g_nbResults) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return (0 == ferror(out));
+}
+
+int main(int argc, char *argv[])
+{
+    long          iterations = BENCH_ITERATIONS;
+    int           workers    = BENCH_WORKERS;
+    const char   *output     = NULL;
+    bench_hist    hist;
+    bench_shared *shared     = NULL;
+    FILE         *out        = stdout;
+    int           res        = EXIT_SUCCESS;
+    int           opt;
+
+    while (-1 != (opt = getopt(argc, argv, "i:w:o:")))
+    {
+        if      ('i' == opt) { iterations = atol(optarg); }
+        else if ('w' == opt) { workers    = atoi(optarg); }
+        else if ('o' == opt) { output     = optarg;       }
+        else                 { optind     = argc + 1;     }
+    }
+    if ((optind + 1 != argc) || (iterations <= 0) || (workers <= 0) || (workers > BENCH_MAX_WORKERS))
+    {
+        fprintf(stderr, "usage: %s [-i iterations] [-w workers (1..%d)] [-o result.json] file\n",
+                argv[0], BENCH_MAX_WORKERS);
+        return EXIT_FAILURE;
+    }
+    const char *fileName = argv[optind];
+
+    if (rl_init_library() != 0)
+    {
+        PROC_ERROR("rl_init_library failed");
+        return EXIT_FAILURE;
+    }
+
+    shared = mmap(NULL, sizeof(bench_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == shared)
+    {
+        PROC_ERROR("mmap failed");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "%-28s %3s %10s %14s %10s %10s %10s %10s\n",
+            "benchmark", "n", "ops", "ops/s", "mean ns", "p50 ns", "p99 ns", "p999 ns");
+
+    //contended runs share the iterations among workers, fork rounds are bounded by process creation
+    long perWorker = (iterations / workers) ? (iterations / workers) : 1;
+    long slow      = (iterations / 100) ? (iterations / 100) : 1;
+    long rounds    = (slow < BENCH_FORK_ROUNDS) ? slow : BENCH_FORK_ROUNDS;
+    int  held[]    = {0, 16, 64, 256, 1024};
+
+    if ((!bench_uncontended(fileName, "lock_unlock_read", F_RDLCK, iterations, &hist)) ||
+        (!bench_uncontended(fileName, "lock_unlock_write", F_WRLCK, iterations, &hist)) ||
+        (!bench_contended_threads(fileName, shared, workers, perWorker, &hist)) ||
+        (!bench_contended_processes(fileName, shared, workers, perWorker, &hist)) ||
+        (!bench_open_close(fileName, true, iterations, &hist)) ||
+        (!bench_open_close(fileName, false, slow, &hist)) ||
+        (!bench_dup_close(fileName, iterations, &hist)))
+    {
+        PROC_ERROR("benchmark failed");
+        res = EXIT_FAILURE;
+        goto lExit;
+    }
+    for (size_t i = 0; i < sizeof(held) / sizeof(held[0]); i++)
+    {
+        if (!bench_fork(fileName, held[i], rounds, &hist))
+        {
+            PROC_ERROR("benchmark failed");
+            res = EXIT_FAILURE;
+            goto lExit;
+        }
+    }
+
+    if ((output) && (NULL == (out = fopen(output, "w"))))
+    {
+        PROC_ERROR("can't open output");
+        res = EXIT_FAILURE;
+        goto lExit;
+    }
+    if (!write_json(out, iterations, workers))
+    {
+        PROC_ERROR("can't write output");
+        res = EXIT_FAILURE;
+    }
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+lExit:
+    munmap(shared, sizeof(bench_shared));
+    return res;
+}
@@ -1,5 +1,6 @@
 #include "rl_lock_library.h"
 #include <unistd.h>
+#include <dirent.h>
 
 #define SHR_TEST_SEM        "/rl_test_shared_sem"
 
@@ -148,9 +149,9 @@ bool test_regions(const char *fileName)
     printf("**********************************************\n");
 
     return true;
-    //checking for region joining: we have NB_LOCKS = 10 so trying to push more
-    //has to generate error if inside we are not joining them
-    /*for (int i = 0; i < 2* NB_LOCKS; i++)
+    //checking for region joining: pushing more locks than fit in a segment
+    //makes the shared object grow if inside we are not joining them
+    /*for (int i = 0; i < 2 * RL_SEGMENT_SIZE / sizeof(rl_lock); i++)
     {
         lck.l_start  = i*50;
         lck.l_len    = 50; 
@@ -437,6 +438,2107 @@ bool test_record_blocking_request(const char *fileName)
 }
 
 
+bool test_many_locks(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_dups[64];
+    bool          bResult = true;
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    //more locks than a single segment holds, separated by holes so they aren't joined
+    struct flock lck;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    for (int i = 0; i < 3000; i++)
+    {
+        lck.l_start = i * 20;
+        if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+        {
+            return false;
+        }
+    }
+
+    //must fail = last lock is in a grown segment
+    lck.l_start  = 2999 * 20 + 5;
+    lck.l_len    = 1; 
+    lck.l_type   = F_RDLCK;
+    if (0 == rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        bResult = false;
+    }
+
+    //hole between 2 locks is free
+    lck.l_start  = 2998 * 20 + 10;
+    lck.l_len    = 10; 
+    if (0 != rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        bResult = false;
+    }
+
+    lck.l_start  = 0;
+    lck.l_len    = 3000 * 20; 
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_fcntl(rl_fd2, F_SETLK, &lck)))
+    {
+        bResult = false;
+    }
+
+    //more owners of a read lock than the old per lock limit
+    lck.l_start  = 0;
+    lck.l_len    = 100; 
+    lck.l_type   = F_RDLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        bResult = false;
+    }
+    for (int i = 0; i < 64; i++)
+    {
+        rl_dups[i] = rl_dup(rl_fd1);
+        if (rl_dups[i].f == NULL)
+        {
+            return false;
+        }
+    }
+    rl_close(rl_fd1);
+
+    //must fail = read lock is still owned by the duplicates
+    lck.l_type   = F_WRLCK;
+    if (0 == rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        bResult = false;
+    }
+
+    for (int i = 0; i < 64; i++)
+    {
+        rl_close(rl_dups[i]);
+    }
+
+    if (0 != rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        bResult = false;
+    }
+
+    lck.l_type   = F_UNLCK;
+    rl_fcntl(rl_fd2, F_SETLK, &lck);
+
+    return (0 == rl_close(rl_fd2)) && bResult;
+}
+
+
+static int count_fast_locks(rl_open_file *f)
+{
+    int nb = 0;
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
+    {
+        nb += (f->fast_locks[i].state > 0);    //held, a slot busy with a change is marked with a negative pid
+    }
+    return nb;
+}
+
+bool test_read_fast_path(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    //second open of the file reuses the mapping
+    if ((rl_fd1.f == NULL) || (rl_fd2.f != rl_fd1.f) || (rl_fd1.f->refCnt != 2))
+    {
+        return false;
+    }
+
+    //table is empty: both read locks are taken in fast slots
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 100; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    lck.l_start  = 50;
+    if ((0 != rl_fcntl(rl_fd2, F_SETLK, &lck)) || (0 != rl_fd1.f->fast_state) || (2 != count_fast_locks(rl_fd1.f)))
+    {
+        return false;
+    }
+
+    //must fail = fast read lock of rl_fd1 is moved to the table and conflicts
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_type   = F_WRLCK;
+    if (0 == rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+    rl_print(rl_fd1);
+
+    lck.l_len    = 100; 
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    lck.l_len    = 10; 
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //table is empty again, fast path is open
+    lck.l_len    = 1000; 
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd2, F_SETLK, &lck)) || (0 != rl_fd1.f->fast_state) || (0 != count_fast_locks(rl_fd1.f)))
+    {
+        return false;
+    }
+
+    lck.l_len    = 10; 
+    lck.l_type   = F_RDLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_fd1.f->fast_state) || (1 != count_fast_locks(rl_fd1.f)))
+    {
+        return false;
+    }
+
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_fd1.f->fast_state) || (0 != count_fast_locks(rl_fd1.f)))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+bool test_dead_owner(const char *fileName)
+{
+    rl_descriptor rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if (rl_fd.f == NULL)
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 100; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+
+    //plain fork: the child shares the mapping, takes the lock and dies without releasing it
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        _exit((0 == rl_fcntl(rl_fd, F_SETLK, &lck)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int status = 0;
+    if ((pid != waitpid(pid, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+    {
+        return false;
+    }
+
+    //must succeed = the lock of the dead process is removed when it conflicts
+    if (0 != rl_fcntl(rl_fd, F_SETLK, &lck))
+    {
+        return false;
+    }
+    rl_print(rl_fd);
+
+    return (0 == rl_close(rl_fd));
+}
+
+bool test_batch(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 100;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    struct flock batch[4] = {
+        {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 105, .l_len = 15},
+        {.l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = 0,   .l_len = 10},
+        {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 50,  .l_len = 10},
+        {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 55,  .l_len = 10},
+    };
+
+    //must fail = [105..119] conflicts, and no other region is taken
+    if (0 == rl_fcntl_batch(rl_fd2, F_SETLK, batch, 4))
+    {
+        return false;
+    }
+
+    lck.l_start  = 0;
+    lck.l_len    = 100; 
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    lck.l_len    = 110; 
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    if (0 != rl_fcntl_batch(rl_fd2, F_SETLK, batch, 4))
+    {
+        return false;
+    }
+    rl_print(rl_fd2);
+
+    //must fail = [50..64] is coalesced and held by rl_fd2
+    lck.l_start  = 62;
+    lck.l_len    = 1; 
+    lck.l_type   = F_RDLCK;
+    if (0 == rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        batch[i].l_type = F_UNLCK;
+    }
+    if ((0 != rl_fcntl_batch(rl_fd2, F_SETLK, batch, 4)) || (0 != rl_fcntl(rl_fd1, F_SETLK, &lck)))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+bool test_many_descriptors(const char *fileName)
+{
+    #define NB_DESCRIPTORS 300 //more than the former limit of 256 open files 
+
+    rl_descriptor rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_dups[NB_DESCRIPTORS];
+
+    if (rl_fd.f == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < NB_DESCRIPTORS; i++)
+    {
+        rl_dups[i] = rl_dup(rl_fd);
+        if (rl_dups[i].f == NULL)
+        {
+            return false;
+        }
+    }
+
+    if (rl_fd.f->refCnt != NB_DESCRIPTORS + 1)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < NB_DESCRIPTORS; i++)
+    {
+        if (NB_DESCRIPTORS - i != rl_close(rl_dups[i]))
+        {
+            return false;
+        }
+    }
+
+    return (0 == rl_close(rl_fd));
+}
+
+bool test_many_files(const char *fileName)
+{
+    #define NB_FILES 400 //far more than the initial buckets of a registry shard
+
+    rl_descriptor rl_fds[NB_FILES];
+    rl_descriptor rl_dups[NB_FILES];
+    char          names[NB_FILES][256];
+    bool          isOk = true;
+
+    for (int i = 0; i < NB_FILES; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "%s.%d", fileName, i);
+        rl_fds[i]  = rl_open(names[i], O_RDWR|O_CREAT, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+        rl_dups[i] = rl_fds[i];
+        if (rl_fds[i].f == NULL)
+        {
+            return false;
+        }
+    }
+
+    //must succeed = each file resolves to its own shared object, a second descriptor to the same one
+    for (int i = 0; (i < NB_FILES) && (isOk); i++)
+    {
+        for (int j = 0; (j < i) && (isOk); j++)
+        {
+            isOk = (rl_fds[i].f != rl_fds[j].f);
+        }
+
+        if ((isOk) && (i % 3 == 0))
+        {
+            rl_dups[i] = rl_open(names[i], O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+            isOk       = (rl_dups[i].f == rl_fds[i].f);
+        }
+        isOk = (isOk) && (rl_fds[i].f->refCnt == ((i % 3 == 0) ? 2 : 1));
+    }
+
+    //close odd files, then even ones from the end, second descriptors first
+    for (int i = 1; (i < NB_FILES) && (isOk); i += 2)
+    {
+        if (i % 3 == 0)
+        {
+            isOk = (1 == rl_close(rl_dups[i]));
+        }
+        isOk = (isOk) && (0 == rl_close(rl_fds[i]));
+    }
+
+    for (int i = NB_FILES - 2; (i >= 0) && (isOk); i -= 2)
+    {
+        //must succeed = files still open keep their shared object and references
+        rl_descriptor rl_fd = rl_open(names[i], O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+        isOk = (rl_fd.f == rl_fds[i].f) && (rl_fds[i].f->refCnt == ((i % 3 == 0) ? 3 : 2)) && (rl_fds[i].f->refCnt - 1 == rl_close(rl_fd));
+
+        if ((isOk) && (i % 3 == 0))
+        {
+            isOk = (1 == rl_close(rl_dups[i]));
+        }
+        isOk = (isOk) && (0 == rl_close(rl_fds[i]));
+    }
+
+    for (int i = 0; i < NB_FILES; i++)
+    {
+        unlink(names[i]);
+    }
+    return isOk;
+}
+
+bool test_query(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    lck.l_start  = 20;
+    lck.l_type   = F_RDLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //conflicting lock of rl_fd1 is returned
+    lck.l_start  = 5;
+    lck.l_len    = 20; 
+    lck.l_type   = F_WRLCK;
+    if (    (0 != rl_fcntl(rl_fd2, F_GETLK, &lck))
+         || (lck.l_type != F_WRLCK) || (lck.l_start != 0) || (lck.l_len != 10) || (lck.l_pid != getpid())
+       )
+    {
+        return false;
+    }
+
+    //own locks don't conflict
+    lck.l_start  = 0;
+    lck.l_len    = 100; 
+    lck.l_type   = F_WRLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_GETLK, &lck)) || (lck.l_type != F_UNLCK))
+    {
+        return false;
+    }
+
+    struct flock conflicts[4];
+    lck.l_type   = F_WRLCK;
+    if (2 != rl_query_conflicts(rl_fd2, &lck, conflicts, 4))
+    {
+        return false;
+    }
+    lck.l_type   = F_RDLCK;
+    if ((1 != rl_query_conflicts(rl_fd2, &lck, conflicts, 4)) || (conflicts[0].l_type != F_WRLCK))
+    {
+        return false;
+    }
+
+    //read lock taken in a fast slot conflicts with a write request
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_start  = 50;
+    lck.l_len    = 10; 
+    lck.l_type   = F_RDLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_fd1.f->fast_state) || (1 != count_fast_locks(rl_fd1.f)))
+    {
+        return false;
+    }
+    lck.l_start  = 0;
+    lck.l_len    = 100; 
+    lck.l_type   = F_WRLCK;
+    if ((0 != rl_fcntl(rl_fd2, F_GETLK, &lck)) || (lck.l_type != F_RDLCK) || (lck.l_start != 50))
+    {
+        return false;
+    }
+
+    //must fail = a table that stays in the middle of a change isn't read, and the mutex isn't taken
+    unsigned int seq = rl_fd1.f->seq;
+    rl_fd1.f->seq    = seq | 1u;
+    lck.l_type   = F_WRLCK;
+    bool isBusy  = (-1 == rl_query_conflicts(rl_fd2, &lck, conflicts, 4)) && (errno == EAGAIN)
+                && (-1 == rl_fcntl(rl_fd2, F_GETLK, &lck)) && (errno == EAGAIN) && (0 == rl_fd1.f->fast_state);
+    rl_fd1.f->seq    = seq;
+    if (!isBusy)
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+bool test_timed_lock(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //must time out after 200ms, without staying in waiters
+    struct timespec deadline, now;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += 200 * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000)
+    {
+        deadline.tv_sec  += 1;
+        deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    struct rl_stats before, after;
+    lck.l_start  = 5;
+    if (    (0 != rl_stats(rl_fd1, &before))
+         || (0 == rl_fcntl_timed(rl_fd2, F_SETLKW, &lck, &deadline)) || (errno != ETIMEDOUT) || (rl_fd1.f->blockCnt != 0)
+       )
+    {
+        return false;
+    }
+
+    //must succeed = the wait ran into its deadline, nobody woke it up
+    if (    (0 != rl_stats(rl_fd1, &after)) || (after.timeouts - before.timeouts != 1)
+         || (after.wakeups != before.wakeups) || (after.spurious_wakeups != before.spurious_wakeups)
+       )
+    {
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec < deadline.tv_sec) || ((now.tv_sec == deadline.tv_sec) && (now.tv_nsec < deadline.tv_nsec)))
+    {
+        return false;
+    }
+
+    //deadline in the future doesn't matter if the region is free
+    deadline.tv_sec += 10;
+    lck.l_start  = 10;
+    if (0 != rl_fcntl_timed(rl_fd2, F_SETLKW, &lck, &deadline))
+    {
+        return false;
+    }
+
+    //a deadline out of range or another command is rejected at once, even on a busy region
+    lck.l_start  = 0;
+    deadline.tv_nsec = 1000 * 1000 * 1000;
+    if ((0 == rl_fcntl_timed(rl_fd2, F_SETLKW, &lck, &deadline)) || (errno != EINVAL))
+    {
+        return false;
+    }
+
+    deadline.tv_nsec = -1;
+    if ((0 == rl_fcntl_timed(rl_fd2, F_SETLKW, &lck, &deadline)) || (errno != EINVAL))
+    {
+        return false;
+    }
+
+    deadline.tv_nsec = 0;
+    if (    ((0 == rl_fcntl_timed(rl_fd2, F_GETLK, &lck, &deadline)) || (errno != EINVAL))
+         || ((0 == rl_fcntl_timed(rl_fd2, 42, &lck, NULL)) || (errno != EINVAL))
+         || ((0 == rl_fcntl(rl_fd2, 42, &lck)) || (errno != EINVAL))
+         || (rl_fd1.f->blockCnt != 0)
+       )
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+bool test_deadlock(const char *fileName)
+{
+    rl_descriptor rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if (rl_fd.f == NULL)
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //the child takes [10..19] then waits for [0..9]
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        struct flock own = lck;
+        own.l_start = 10;
+        bool isOk = (0 == rl_fcntl(rl_fd, F_SETLK, &own)) && (0 == rl_fcntl(rl_fd, F_SETLKW, &lck));
+        own.l_start = 0;
+        own.l_len   = 20;
+        own.l_type  = F_UNLCK;
+        isOk = isOk && (0 == rl_fcntl(rl_fd, F_SETLK, &own));
+        _exit(isOk ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    while (rl_fd.f->blockCnt == 0)
+    {
+        usleep(1000);
+    }
+
+    //must fail = waiting for [10..19] closes the cycle
+    lck.l_start  = 10;
+    if ((0 == rl_fcntl(rl_fd, F_SETLKW, &lck)) || (errno != EDEADLK) || (rl_fd.f->blockCnt != 1))
+    {
+        return false;
+    }
+
+    lck.l_start  = 0;
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    int status = 0;
+    if ((pid != waitpid(pid, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+    {
+        return false;
+    }
+
+    return (0 == rl_close(rl_fd));
+}
+
+static rl_waiter *test_waiter_at(rl_open_file *f, int index)
+{
+    rl_pool *pool = &f->waiter_pool;
+    return (rl_waiter *)((char *)f + RL_HEADER_SIZE + (size_t)pool->segments[index / pool->slots_per_segment] * RL_SEGMENT_SIZE
+                                   + (size_t)(index % pool->slots_per_segment) * pool->slot_size);
+}
+
+static pid_t fork_waiter(rl_descriptor rl_fd, struct flock *lck)
+{
+    pid_t pid = fork();
+    if (0 == pid)
+    {
+        struct flock wr = *lck;
+        bool isOk = (0 == rl_fcntl(rl_fd, F_SETLKW, &wr));
+        wr.l_type = F_UNLCK;
+        isOk = isOk && (0 == rl_fcntl(rl_fd, F_SETLK, &wr));
+        _exit(isOk ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    return pid;
+}
+
+bool test_targeted_wakeup(const char *fileName)
+{
+    rl_descriptor   rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    struct rl_stats before;
+    struct rl_stats after;
+
+    if (rl_fd.f == NULL)
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_start  = 20;
+    if (0 != rl_fcntl(rl_fd, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //child 1 waits for [0..10[, child 2 for [20..30[
+    pid_t pid2 = fork_waiter(rl_fd, &lck);
+    lck.l_start  = 0;
+    pid_t pid1 = fork_waiter(rl_fd, &lck);
+    if ((-1 == pid1) || (-1 == pid2))
+    {
+        return false;
+    }
+
+    while (rl_fd.f->blockCnt != 2)
+    {
+        usleep(1000);
+    }
+
+    //both children sleep, the queue doesn't change under us
+    int waiterIdx = rl_fd.f->first_waiter;
+    if (test_waiter_at(rl_fd.f, waiterIdx)->start != 20)
+    {
+        waiterIdx = test_waiter_at(rl_fd.f, waiterIdx)->next;
+    }
+    rl_waiter *waiter2 = test_waiter_at(rl_fd.f, waiterIdx);
+    if ((waiter2->start != 20) || (0 != rl_stats(rl_fd, &before)))
+    {
+        return false;
+    }
+
+    //must succeed = releasing [0..10[ wakes up child 1 only, child 2 keeps sleeping
+    lck.l_type   = F_UNLCK;
+    if (    (0 != rl_fcntl(rl_fd, F_SETLK, &lck)) 
+         || (0 != __atomic_load_n(&waiter2->wake, __ATOMIC_ACQUIRE))
+       )
+    {
+        return false;
+    }
+
+    int status = 0;
+    if ((pid1 != waitpid(pid1, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+    {
+        return false;
+    }
+    usleep(50000);
+
+    if (    (0 != rl_stats(rl_fd, &after)) || (0 != waitpid(pid2, &status, WNOHANG))
+         || (rl_fd.f->blockCnt != 1) || (0 != __atomic_load_n(&waiter2->wake, __ATOMIC_ACQUIRE))
+         || (after.wakeups - before.wakeups != 1) || (after.spurious_wakeups != before.spurious_wakeups)
+       )
+    {
+        return false;
+    }
+
+    lck.l_start  = 20;
+    if (    (0 != rl_fcntl(rl_fd, F_SETLK, &lck)) 
+         || (pid2 != waitpid(pid2, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS)
+       )
+    {
+        return false;
+    }
+
+    return (0 == rl_close(rl_fd));
+}
+
+bool test_policy(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //a writer of the child waits for the reader
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        struct flock wr = lck;
+        wr.l_type = F_WRLCK;
+        bool isOk = (0 == rl_fcntl(rl_fd1, F_SETLKW, &wr));
+        wr.l_type = F_UNLCK;
+        isOk = isOk && (0 == rl_fcntl(rl_fd1, F_SETLK, &wr));
+        _exit(isOk ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    while (rl_fd1.f->blockCnt == 0)
+    {
+        usleep(1000);
+    }
+
+    //must succeed = readers go ahead of the queued writer
+    lck.l_start  = 5;
+    if ((0 != rl_fcntl(rl_fd2, F_SETLK, &lck)) || (0 != rl_fcntl(rl_fd2, F_GETLK, &lck)))
+    {
+        return false;
+    }
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //must fail = the new reader waits for the queued writer
+    lck.l_type   = F_RDLCK;
+    for (int policy = RL_POLICY_WRITERS; policy <= RL_POLICY_FIFO; policy++)
+    {
+        if ((0 != rl_set_policy(rl_fd1, policy)) || (0 == rl_fcntl(rl_fd2, F_SETLK, &lck)) || (errno != EAGAIN))
+        {
+            return false;
+        }
+    }
+
+    //must succeed = the holder blocking the writer isn't queued behind it
+    lck.l_len    = 20;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    lck.l_start  = 0;
+    lck.l_len    = 25;
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    int status = 0;
+    if ((pid != waitpid(pid, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+    {
+        return false;
+    }
+
+    rl_set_policy(rl_fd1, RL_POLICY_READERS);
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+bool test_upgrade(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_upgrade(rl_fd1, F_SETLK, &lck)))
+    {
+        return false;
+    }
+
+    //must fail = the region is now locked for writing
+    if (0 == rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+    rl_print(rl_fd1);
+
+    //must succeed = readers share the region again
+    if ((0 != rl_downgrade(rl_fd1, &lck)) || (0 != rl_fcntl(rl_fd2, F_SETLK, &lck)))
+    {
+        return false;
+    }
+
+    //must fail = another reader holds the region
+    if ((0 == rl_upgrade(rl_fd1, F_SETLK, &lck)) || (errno != EAGAIN))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+
+    //must succeed = the other reader is gone
+    if (0 != rl_upgrade(rl_fd1, F_SETLKW, &lck))
+    {
+        return false;
+    }
+
+    return (0 == rl_close(rl_fd1));
+}
+
+static void *thread_write_lock(void *arg)
+{
+    rl_descriptor *rl_fd = arg;
+    struct flock   lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+
+    return (0 == rl_fcntl(*rl_fd, F_SETLK, &lck)) ? arg : NULL;
+}
+
+bool test_thread_owner(const char *fileName)
+{
+    rl_descriptor rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if (rl_fd.f == NULL)
+    {
+        return false;
+    }
+    rl_fd.flags = RL_OWNER_THREAD;
+
+    pthread_t thread;
+    void     *res = NULL;
+    if ((0 != pthread_create(&thread, NULL, thread_write_lock, &rl_fd)) || (0 != pthread_join(thread, &res)) || (!res))
+    {
+        return false;
+    }
+
+    //must fail = the lock belongs to the other thread, and unlocking here leaves it
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_type   = F_RDLCK;
+    if (0 == rl_fcntl(rl_fd, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //must succeed = handles with the same token are the same owner
+    rl_descriptor rl_h1 = rl_fd;
+    rl_descriptor rl_h2 = rl_fd;
+    rl_h1.flags = rl_h2.flags = RL_OWNER_TOKEN;
+    rl_h1.token = rl_h2.token = 42;
+    lck.l_start  = 20;
+    lck.l_type   = F_WRLCK;
+    if ((0 != rl_fcntl(rl_h1, F_SETLK, &lck)) || (0 != rl_fcntl(rl_h2, F_SETLK, &lck)))
+    {
+        return false;
+    }
+    rl_h2.token = 43;
+    if (0 == rl_fcntl(rl_h2, F_SETLK, &lck))
+    {
+        return false;
+    }
+    rl_print(rl_fd);
+
+    //closing releases the locks of every owner
+    return (0 == rl_close(rl_fd));
+}
+
+bool test_fork_references(const char *fileName)
+{
+    rl_descriptor rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if (rl_fd.f == NULL)
+    {
+        return false;
+    }
+
+    //children hold one reference each until they close
+    pid_t pids[16];
+    for (int i = 0; i < 16; i++)
+    {
+        if (-1 == (pids[i] = rl_fork()))
+        {
+            return false;
+        }
+        if (0 == pids[i])
+        {
+            bool isOk = (rl_fd.f->refCnt >= 2);
+            rl_close(rl_fd);
+            _exit(isOk ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        int status = 0;
+        if ((pids[i] != waitpid(pids[i], &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+        {
+            return false;
+        }
+    }
+
+    //must be the last reference
+    if (rl_fd.f->refCnt != 1)
+    {
+        return false;
+    }
+
+    return (0 == rl_close(rl_fd));
+}
+
+bool test_lazy_fork(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    int           fds[2];
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL) || (0 != pipe(fds)))
+    {
+        return false;
+    }
+
+    //fast and table read locks
+    struct flock lck;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+    for (lck.l_start = 0; lck.l_start < 2000; lck.l_start += 20)
+    {
+        if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+        {
+            return false;
+        }
+    }
+
+    //the child keeps inherited locks until the parent lets it go
+    pid_t pid = rl_fork();
+    if (-1 == pid)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        char c;
+        close(fds[1]);
+        read(fds[0], &c, 1);
+        rl_close(rl_fd2);
+        rl_close(rl_fd1);
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[0]);
+
+    lck.l_start  = 0;
+    lck.l_len    = 2000;
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //must fail = the child has inherited the read locks
+    lck.l_type   = F_WRLCK;
+    if (0 == rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    int status = 0;
+    write(fds[1], "x", 1);
+    close(fds[1]);
+    if ((pid != waitpid(pid, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+    {
+        return false;
+    }
+
+    //must succeed = locks are released with the child
+    if ((0 != rl_fcntl(rl_fd2, F_SETLK, &lck)) || (rl_fd2.f->nb_inherits != 0))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+
+bool test_range(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    //[100..EOF[ covers the file however far it grows
+    struct flock lck;
+    lck.l_start  = 100;
+    lck.l_len    = 0; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //must fail = far behind the current end of file but still in the region
+    lck.l_start = (off_t)1 << 40;
+    lck.l_len   = 10; 
+    if (0 == rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //must report the region to the end of file with l_len 0
+    if ((0 != rl_fcntl(rl_fd2, F_GETLK, &lck)) || (lck.l_type != F_WRLCK) || (lck.l_start != 100) || (lck.l_len != 0))
+    {
+        return false;
+    }
+
+    //must fail = the region ends after the largest offset
+    lck.l_type  = F_RDLCK;
+    lck.l_start = INT64_MAX - 5;
+    lck.l_len   = 10; 
+    if ((0 == rl_fcntl(rl_fd2, F_SETLK, &lck)) || (errno != EOVERFLOW))
+    {
+        return false;
+    }
+
+    //must succeed = a negative length locks [30..50[ in front of the region
+    lck.l_start = 50;
+    lck.l_len   = -20; 
+    if (0 != rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //must fail = [30..50[ is taken, [50..100[ is free
+    lck.l_type  = F_WRLCK;
+    lck.l_start = 40;
+    lck.l_len   = 1; 
+    if (0 == rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_start = 50;
+    lck.l_len   = 50; 
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+static void *thread_wait_lock(void *arg)
+{
+    rl_descriptor *rl_fd = arg;
+    struct flock   lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+
+    return (0 == rl_fcntl(*rl_fd, F_SETLKW, &lck)) ? arg : NULL;
+}
+
+bool test_stats(const char *fileName)
+{
+    rl_descriptor   rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor   rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    struct rl_stats before;
+    struct rl_stats after;
+    pthread_t       thread;
+    void           *result = NULL;
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL) || (0 != rl_stats(rl_fd1, &before)))
+    {
+        return false;
+    }
+
+    //[0..10[ and [10..20[ are merged, unlocking [4..6[ splits the lock
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_start  = 10;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_start  = 4;
+    lck.l_len    = 2; 
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    //the thread waits for [0..4[ until it is released
+    if (0 != pthread_create(&thread, NULL, thread_wait_lock, &rl_fd2))
+    {
+        return false;
+    }
+    usleep(100000);
+    lck.l_start  = 0;
+    lck.l_len    = 20; 
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != pthread_join(thread, &result)) || (NULL == result))
+    {
+        return false;
+    }
+
+    if (0 != rl_stats(rl_fd2, &after))
+    {
+        return false;
+    }
+    printf("acquisitions %lu, conflicts %lu, waits %lu, wait %lu ns (max %lu ns), wakeups %lu (spurious %lu), "
+           "timeouts %lu, merges %lu, splits %lu\n", after.acquisitions - before.acquisitions, 
+           after.conflicts - before.conflicts, after.waits - before.waits, after.wait_ns - before.wait_ns, 
+           after.max_wait_ns, after.wakeups - before.wakeups, after.spurious_wakeups - before.spurious_wakeups,
+           after.timeouts - before.timeouts, after.merges - before.merges, after.splits - before.splits);
+
+    if (    (after.acquisitions - before.acquisitions != 3) || (after.conflicts - before.conflicts < 1)
+         || (after.waits - before.waits != 1) || (after.wait_ns - before.wait_ns < 50000000)
+         || (after.max_wait_ns < 50000000) || (after.wakeups - before.wakeups < 1)
+         || (after.merges - before.merges != 1) || (after.splits - before.splits != 1)
+       )
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+static size_t count_snapshot_entries(struct rl_snapshot *snap, short kind)
+{
+    size_t nb = 0;
+    for (size_t i = 0; i < snap->nb_entries; i++)
+    {
+        nb += (snap->entries[i].kind == kind);
+    }
+    return nb;
+}
+
+bool test_snapshot(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    pthread_t     thread;
+    void         *result = NULL;
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_start  = 100;
+    lck.l_len    = 0; 
+    lck.l_type   = F_RDLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_fcntl(rl_fd2, F_SETLK, &lck)))
+    {
+        return false;
+    }
+
+    //the thread waits for [0..10[ held by rl_fd1
+    if (0 != pthread_create(&thread, NULL, thread_wait_lock, &rl_fd2))
+    {
+        return false;
+    }
+
+    //must succeed = the size of the snapshot is returned for an empty buffer
+    ssize_t             size = rl_snapshot(rl_fd1, NULL, 0);
+    struct rl_snapshot *snap = malloc(sizeof(struct rl_snapshot) + 16 * sizeof(rl_snapshot_entry));
+    if ((size < (ssize_t)sizeof(struct rl_snapshot)) || (!snap))
+    {
+        return false;
+    }
+
+    //must succeed = the waiter shows up once it is queued
+    for (int i = 0; i < 1000; i++)
+    {
+        size = rl_snapshot(rl_fd1, snap, sizeof(struct rl_snapshot) + 16 * sizeof(rl_snapshot_entry));
+        if ((size > 0) && (count_snapshot_entries(snap, RL_SNAPSHOT_WAITER) == 1))
+        {
+            break;
+        }
+        usleep(1000);
+    }
+    rl_print(rl_fd1);
+
+    //[0..10[ WR fd1, [100..EOF[ RD fd1 and fd2, waiter [0..10[ WR fd2
+    if (    (size != (ssize_t)(sizeof(struct rl_snapshot) + 4 * sizeof(rl_snapshot_entry)))
+         || (snap->nb_entries != 4) || (snap->refs < 2)
+         || (count_snapshot_entries(snap, RL_SNAPSHOT_LOCK) != 3) || (count_snapshot_entries(snap, RL_SNAPSHOT_WAITER) != 1)
+         || (snap->entries[0].type != F_WRLCK) || (snap->entries[0].start != 0) || (snap->entries[0].len != 10)
+         || (snap->entries[0].des != rl_fd1.d) || (snap->entries[0].pid != getpid())
+         || (snap->entries[1].start != 100) || (snap->entries[1].len != 0) || (snap->entries[1].type != F_RDLCK)
+         || (snap->entries[3].des != rl_fd2.d) || (snap->entries[3].type != F_WRLCK)
+       )
+    {
+        return false;
+    }
+
+    //must succeed = the shared object gives the same state without a descriptor
+    char        name[64];
+    struct stat statBuffer;
+    fstat(rl_fd1.d, &statBuffer);
+    snprintf(name, sizeof(name), "/f_%ld_%ld", (long)statBuffer.st_dev, (long)statBuffer.st_ino);
+    for (int i = 0; i < 100; i++)
+    {
+        if ((0 < (size = rl_snapshot_shared(name, snap, sizeof(struct rl_snapshot) + 16 * sizeof(rl_snapshot_entry))))
+             || (errno != EAGAIN))
+        {
+            break;
+        }
+    }
+    if ((size <= 0) || (snap->nb_entries != 4) || (snap->ino != statBuffer.st_ino))
+    {
+        return false;
+    }
+    free(snap);
+
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != pthread_join(thread, &result)) || (NULL == result))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+static bool shared_object_name(const char *fileName, char *name, size_t size)
+{
+    struct stat statBuffer;
+    if (0 > stat(fileName, &statBuffer))
+    {
+        return false;
+    }
+    snprintf(name, size, "/f_%ld_%ld", (long)statBuffer.st_dev, (long)statBuffer.st_ino);
+    return true;
+}
+
+static int count_named_semaphores(void)
+{
+    DIR *dir = opendir("/dev/shm");
+    int  nb  = 0;
+    if (dir == NULL)
+    {
+        return -1;
+    }
+    for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+    {
+        nb += (0 == strncmp(entry->d_name, "sem.", 4));
+    }
+    closedir(dir);
+    return nb;
+}
+
+bool test_no_named_semaphore(const char *fileName)
+{
+    int nbSemaphores = count_named_semaphores();
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((nbSemaphores < 0) || (rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    //a waiter of another process goes through create, join, wait, wake up and close
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    pid_t pid = fork_waiter(rl_fd2, &lck);
+    if (-1 == pid)
+    {
+        return false;
+    }
+    while (rl_fd1.f->blockCnt == 0)
+    {
+        usleep(1000);
+    }
+
+    //must succeed = the shared object is the only thing created in /dev/shm
+    int status = 0;
+    lck.l_type   = F_UNLCK;
+    if (    (nbSemaphores != count_named_semaphores())
+         || (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+         || (pid != waitpid(pid, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS)
+       )
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1)) && (nbSemaphores == count_named_semaphores());
+}
+
+#define DEAD_UNSIZED    0   //creator dies right after creating the object
+#define DEAD_NO_PID     1   //creator dies after sizing it, before storing its pid
+#define DEAD_PID        2   //creator dies after storing its pid, before the object is ready
+
+static bool leave_dead_creator(const char *name, int stage)
+{
+    //the child creates the shared object and dies before marking it ready
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        int fd = shm_open(name, O_CREAT | O_RDWR | O_EXCL, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+        if ((0 > fd) || ((stage != DEAD_UNSIZED) && (0 > ftruncate(fd, RL_HEADER_SIZE))))
+        {
+            _exit(EXIT_FAILURE);
+        }
+        if (stage == DEAD_PID)
+        {
+            rl_open_file *f = mmap(0, RL_HEADER_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+            if (MAP_FAILED == (void *)f)
+            {
+                _exit(EXIT_FAILURE);
+            }
+            f->creator = getpid();
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status = 0;
+    return (pid == waitpid(pid, &status, 0)) && (WIFEXITED(status)) && (WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+bool test_dead_creator(const char *fileName)
+{
+    char name[64];
+    if (!shared_object_name(fileName, name, sizeof(name)))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    for (int stage = DEAD_UNSIZED; stage <= DEAD_PID; stage++)
+    {
+        if (!leave_dead_creator(name, stage))
+        {
+            shm_unlink(name);
+            return false;
+        }
+
+        //must succeed = the orphan is detected, unlinked and replaced by an object created here
+        rl_descriptor rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+        if ((rl_fd.f == NULL) || (rl_fd.f->creator != getpid()) || (rl_fd.f->refCnt != 1))
+        {
+            shm_unlink(name);
+            return false;
+        }
+
+        if (    (0 != rl_fcntl(rl_fd, F_SETLK, &lck)) || (0 != rl_close(rl_fd)) 
+             || (0 <= shm_open(name, O_RDWR, 0)) || (errno != ENOENT)
+           )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool test_recreate(const char *fileName)
+{
+    char name[64];
+    if (!shared_object_name(fileName, name, sizeof(name)))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    for (int i = 0; i < 3; i++)
+    {
+        //must succeed = each round creates a fresh object, the last close unlinks it
+        rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+        rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+        if (    (rl_fd1.f == NULL) || (rl_fd2.f == NULL) || (rl_fd1.f->refCnt != 2) || (rl_fd1.f->blockCnt != 0)
+             || (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+           )
+        {
+            return false;
+        }
+
+        //must fail = the lock of the previous round is gone, this one is held
+        if ((0 == rl_fcntl(rl_fd2, F_SETLK, &lck)) || (errno != EAGAIN))
+        {
+            return false;
+        }
+
+        if ((1 != rl_close(rl_fd2)) || (0 != rl_close(rl_fd1)))
+        {
+            return false;
+        }
+        if ((0 <= shm_open(name, O_RDWR, 0)) || (errno != ENOENT))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool test_hold_histogram(const char *fileName)
+{
+    rl_descriptor   rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    struct rl_holds before;
+    struct rl_holds after;
+
+    if (    (rl_fd1.f == NULL) || (0 != rl_set_hold_histogram(rl_fd1, true))
+         || (0 != rl_hold_histogram(rl_fd1, &before))
+       )
+    {
+        return false;
+    }
+
+    //a fast read lock of 10 bytes, then a write lock of 1000 bytes held for 20 ms
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    lck.l_len    = 1000; 
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    usleep(20000);
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_hold_histogram(rl_fd1, &after)))
+    {
+        return false;
+    }
+
+    //size class 0: [1..16[, size class 2: [256..4096[, 20 ms is in time class 15: [16384..32768[ us
+    uint64_t small = 0;
+    uint64_t large = 0;
+    for (int j = 0; j < RL_HOLD_TIMES; j++)
+    {
+        small += after.counts[0][j] - before.counts[0][j];
+        large += after.counts[2][j] - before.counts[2][j];
+    }
+    printf("holds : %lu of 10 bytes, %lu of 1000 bytes\n", small, large);
+    if ((small != 1) || (large != 1) || (after.counts[2][15] - before.counts[2][15] != 1))
+    {
+        return false;
+    }
+
+    rl_set_hold_histogram(rl_fd1, false);
+    return (0 == rl_close(rl_fd1));
+}
+
+bool test_reshape(const char *fileName)
+{
+    rl_descriptor       rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor       rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    size_t              size   = sizeof(struct rl_snapshot) + 16 * sizeof(rl_snapshot_entry);
+    struct rl_snapshot *snap   = malloc(size);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL) || (!snap))
+    {
+        return false;
+    }
+
+    //must succeed = a hole punched in [0..1000[ keeps the lock slot for [0..100[ and adds [200..1000[
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 1000;
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    int first    = rl_fd1.f->first;
+    lck.l_start  = 100;
+    lck.l_len    = 100;
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 >= rl_snapshot(rl_fd1, snap, size)))
+    {
+        return false;
+    }
+    rl_print(rl_fd1);
+    if (    (rl_fd1.f->first != first) || (snap->nb_entries != 2)
+         || (snap->entries[0].start != 0) || (snap->entries[0].len != 100)
+         || (snap->entries[1].start != 200) || (snap->entries[1].len != 800)
+       )
+    {
+        return false;
+    }
+
+    //must succeed = [1000..1010[ then [1020..1030[ then [1010..1020[ extend [200..1000[ to [200..1030[
+    off_t starts[] = {1000, 1020, 1010};
+    lck.l_type   = F_WRLCK;
+    lck.l_len    = 10;
+    for (int i = 0; i < 3; i++)
+    {
+        lck.l_start = starts[i];
+        if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+        {
+            return false;
+        }
+    }
+    if (0 >= rl_snapshot(rl_fd1, snap, size))
+    {
+        return false;
+    }
+    rl_print(rl_fd1);
+    if (    (rl_fd1.f->first != first) || (snap->nb_entries != 2)
+         || (snap->entries[1].start != 200) || (snap->entries[1].len != 830)
+       )
+    {
+        return false;
+    }
+
+    //must succeed = a read lock shared with rl_fd2 stays whole for rl_fd2
+    lck.l_start  = 0;
+    lck.l_len    = 0;
+    lck.l_type   = F_UNLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_len    = 100;
+    lck.l_type   = F_RDLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_fcntl(rl_fd2, F_SETLK, &lck)))
+    {
+        return false;
+    }
+    lck.l_start  = 40;
+    lck.l_len    = 20;
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 >= rl_snapshot(rl_fd1, snap, size)))
+    {
+        return false;
+    }
+    rl_print(rl_fd1);
+
+    size_t whole  = 0;
+    size_t pieces = 0;
+    for (size_t i = 0; i < snap->nb_entries; i++)
+    {
+        rl_snapshot_entry *e = &snap->entries[i];
+        whole  += ((e->des == rl_fd2.d) && (e->start == 0) && (e->len == 100));
+        pieces += ((e->des == rl_fd1.d) && (((e->start == 0) && (e->len == 40)) || ((e->start == 60) && (e->len == 40))));
+    }
+    size_t entries = snap->nb_entries;
+    free(snap);
+    if ((entries != 3) || (whole != 1) || (pieces != 2))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+typedef struct
+{
+    rl_descriptor     *rl_fd;
+    off_t              start;
+    int               *ready;   /* threads spinning until both are ready, so that their requests overlap in time */
+} fast_read_arg;
+
+static void *thread_fast_read(void *arg)
+{
+    fast_read_arg *read = arg;
+    struct flock   lck;
+    lck.l_start  = read->start;
+    lck.l_len    = 10;
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+
+    __atomic_fetch_add(read->ready, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(read->ready, __ATOMIC_ACQUIRE) < 2)
+    {
+        sched_yield();
+    }
+    return (0 == rl_fcntl(*read->rl_fd, F_SETLK, &lck)) ? arg : NULL;
+}
+
+bool test_fast_touching(const char *fileName)
+{
+    rl_descriptor       rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    size_t              size   = sizeof(struct rl_snapshot) + 16 * sizeof(rl_snapshot_entry);
+    struct rl_snapshot *snap   = malloc(size);
+    bool                isOk   = true;
+
+    if ((rl_fd1.f == NULL) || (!snap))
+    {
+        return false;
+    }
+
+    //two threads of the same owner race to read lock [0..10[ and [10..20[ on the fast path
+    for (int i = 0; (i < 2000) && (isOk); i++)
+    {
+        int           ready   = 0;
+        fast_read_arg args[2] = {{&rl_fd1, 0, &ready}, {&rl_fd1, 10, &ready}};
+        pthread_t     threads[2];
+        void         *results[2] = {NULL, NULL};
+
+        if (    (0 != pthread_create(&threads[0], NULL, thread_fast_read, &args[0]))
+             || (0 != pthread_create(&threads[1], NULL, thread_fast_read, &args[1]))
+             || (0 != pthread_join(threads[0], &results[0])) || (0 != pthread_join(threads[1], &results[1]))
+             || (!results[0]) || (!results[1])
+           )
+        {
+            return false;
+        }
+
+        //must succeed = touching regions of an owner are joined, never held side by side
+        ssize_t len = -1;
+        while ((0 > (len = rl_snapshot(rl_fd1, snap, size))) && (errno == EAGAIN))
+        {
+        }
+        isOk = (len > 0) && (snap->nb_entries == 1) && (snap->entries[0].start == 0) && (snap->entries[0].len == 20);
+        if (!isOk)
+        {
+            rl_print(rl_fd1);
+        }
+
+        struct flock lck;
+        lck.l_start  = 0;
+        lck.l_len    = 20;
+        lck.l_pid    = getpid();
+        lck.l_whence = SEEK_SET;
+        lck.l_type   = F_UNLCK;
+        if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+        {
+            return false;
+        }
+    }
+
+    free(snap);
+    return (0 == rl_close(rl_fd1)) && (isOk);
+}
+
+bool test_dead_fast_slot(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (1 != count_fast_locks(rl_fd1.f)))
+    {
+        return false;
+    }
+
+    //the child dies in the middle of taking a free slot, and of checking the slot of the parent before a release
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        bool isFree = false;
+        bool isHeld = false;
+        for (int i = 0; i < RL_FAST_SLOTS; i++)
+        {
+            rl_fast_lock *fast = &rl_fd1.f->fast_locks[i];
+            if ((!isHeld) && (fast->state > 0))
+            {
+                fast->state = -getpid();
+                isHeld      = true;
+            }
+            else if ((!isFree) && (fast->state == 0))
+            {
+                fast->state    = -getpid();
+                fast->own.proc = getpid();
+                isFree         = true;
+            }
+        }
+        _exit((isFree && isHeld) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int status = 0;
+    if ((pid != waitpid(pid, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+    {
+        return false;
+    }
+
+    //must succeed = the mutex holder reclaims the slots instead of waiting for the dead child
+    lck.l_start  = 20;
+    lck.l_type   = F_WRLCK;
+    if (0 != rl_fcntl(rl_fd2, F_SETLK, &lck))
+    {
+        return false;
+    }
+    for (int i = 0; i < RL_FAST_SLOTS; i++)
+    {
+        if (rl_fd1.f->fast_locks[i].state != 0)
+        {
+            return false;
+        }
+    }
+
+    //must fail = the read lock of the parent is moved to the table
+    lck.l_start  = 0;
+    if ((0 == rl_fcntl(rl_fd2, F_SETLK, &lck)) || (errno != EAGAIN))
+    {
+        return false;
+    }
+
+    lck.l_len    = 30;
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd1, F_SETLK, &lck)) || (0 != rl_fcntl(rl_fd2, F_SETLK, &lck)) || (0 != rl_fd1.f->fast_state))
+    {
+        return false;
+    }
+
+    rl_close(rl_fd2);
+    return (0 == rl_close(rl_fd1));
+}
+
+bool test_fork_unrelated(const char *fileName)
+{
+    rl_descriptor rl_fd = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    int           pipes[3][2];
+
+    if ((rl_fd.f == NULL) || (0 != pipe(pipes[0])) || (0 != pipe(pipes[1])) || (0 != pipe(pipes[2])))
+    {
+        return false;
+    }
+
+    //the child holds a fast read lock until the parent writes to the pipe
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+    char  c   = 0;
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        bool isOk = (0 == rl_fcntl(rl_fd, F_SETLK, &lck)) && (1 == write(pipes[1][1], &c, 1)) && (1 == read(pipes[0][0], &c, 1));
+        lck.l_type = F_UNLCK;
+        isOk = isOk && (0 == rl_fcntl(rl_fd, F_SETLK, &lck));
+        _exit(isOk ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if ((1 != read(pipes[1][0], &c, 1)) || (0 != rl_fd.f->fast_state) || (1 != count_fast_locks(rl_fd.f)))
+    {
+        return false;
+    }
+
+    //must succeed = a parent without read locks of the file reserves nothing, the fast path stays open
+    pid_t child = rl_fork();
+    if (0 == child)
+    {
+        bool isOk = (1 == read(pipes[2][0], &c, 1));
+        rl_close(rl_fd);
+        _exit(isOk ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    int  status = 0;
+    bool isOpen = (0 == rl_fd.f->fast_state) && (0 == rl_fd.f->nb_inherits);
+    if ((-1 == child) || (1 != write(pipes[2][1], &c, 1)) || (child != waitpid(child, &status, 0)) || (!isOpen))
+    {
+        return false;
+    }
+
+    //must succeed = a record of another process waiting for its child pid doesn't hold the mutex holder
+    pid_t forking = fork();
+    if (0 == forking)
+    {
+        pause();
+        _exit(EXIT_SUCCESS);
+    }
+    rl_fd.f->inherits[0].parent = forking;
+    rl_fd.f->inherits[0].child  = 0;
+    rl_fd.f->inherits[0].state  = 1;
+    rl_fd.f->nb_inherits        = 1;
+    lck.l_start  = 20;
+    lck.l_type   = F_WRLCK;
+    if ((-1 == forking) || (0 != rl_fcntl(rl_fd, F_SETLK, &lck)) || (1 != rl_fd.f->nb_inherits))
+    {
+        return false;
+    }
+
+    //must succeed = the record of the dead process is given back
+    kill(forking, SIGKILL);
+    if (    (forking != waitpid(forking, &status, 0)) 
+         || (1 != write(pipes[0][1], &c, 1))
+         || (pid != waitpid(pid, &status, 0)) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS)
+       )
+    {
+        return false;
+    }
+    lck.l_type   = F_UNLCK;
+    if ((0 != rl_fcntl(rl_fd, F_SETLK, &lck)) || (0 != rl_fd.f->nb_inherits) || (0 != rl_fd.f->inherits[0].state))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        close(pipes[i / 2][i % 2]);
+    }
+    return (0 == rl_close(rl_fd));
+}
+
+typedef struct
+{
+    const char        *fileName;
+    rl_descriptor      rl_fd;
+    int               *ready;   /* threads spinning until both are ready, so that their first opens overlap in time */
+} racing_open_arg;
+
+static void *thread_racing_open(void *arg)
+{
+    racing_open_arg *open = arg;
+
+    __atomic_fetch_add(open->ready, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(open->ready, __ATOMIC_ACQUIRE) < 2)
+    {
+        sched_yield();
+    }
+    open->rl_fd = rl_open(open->fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    return (open->rl_fd.f != NULL) ? arg : NULL;
+}
+
+bool test_racing_open(const char *fileName)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        int             ready   = 0;
+        racing_open_arg args[2] = {{.fileName = fileName, .ready = &ready}, {.fileName = fileName, .ready = &ready}};
+        pthread_t       threads[2];
+        void           *results[2] = {NULL, NULL};
+
+        //both threads open the file first, the one registering second keeps its shared reference
+        if (    (0 != pthread_create(&threads[0], NULL, thread_racing_open, &args[0]))
+             || (0 != pthread_create(&threads[1], NULL, thread_racing_open, &args[1]))
+             || (0 != pthread_join(threads[0], &results[0])) || (0 != pthread_join(threads[1], &results[1]))
+             || (NULL == results[0]) || (NULL == results[1])
+           )
+        {
+            return false;
+        }
+
+        //must succeed = one mapping, two references, the object lives until the second close
+        if (    (args[0].rl_fd.f != args[1].rl_fd.f) || (args[0].rl_fd.f->refCnt != 2) 
+             || (1 != rl_close(args[0].rl_fd)) || (0 != rl_close(args[1].rl_fd))
+           )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_change_unheld(const char *fileName)
+{
+    rl_descriptor rl_fd1 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+    rl_descriptor rl_fd2 = rl_open(fileName, O_RDWR, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR|S_IWGRP|S_IWOTH);
+
+    if ((rl_fd1.f == NULL) || (rl_fd2.f == NULL))
+    {
+        return false;
+    }
+
+    struct flock lck;
+    lck.l_start  = 0;
+    lck.l_len    = 10; 
+    lck.l_pid    = getpid();
+    lck.l_whence = SEEK_SET;
+    lck.l_type   = F_RDLCK;
+
+    //must fail = nothing is held
+    if (    (0 == rl_upgrade(rl_fd1, F_SETLK, &lck)) || (errno != ENOLCK)
+         || (0 == rl_downgrade(rl_fd1, &lck)) || (errno != ENOLCK)
+         || (rl_fd1.f->first >= 0)
+       )
+    {
+        return false;
+    }
+
+    //must fail = the region is held by another descriptor or only partly
+    if (    (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+         || (0 == rl_upgrade(rl_fd2, F_SETLKW, &lck)) || (errno != ENOLCK)
+       )
+    {
+        return false;
+    }
+    lck.l_len = 20;
+    if ((0 == rl_upgrade(rl_fd1, F_SETLK, &lck)) || (errno != ENOLCK))
+    {
+        return false;
+    }
+
+    //must succeed = the failed requests locked nothing
+    lck.l_start = 10;
+    lck.l_len   = 10;
+    lck.l_type  = F_WRLCK;
+    if ((0 != rl_fcntl(rl_fd2, F_SETLK, &lck)) || (0 != rl_downgrade(rl_fd2, &lck)))
+    {
+        return false;
+    }
+
+    //must succeed = the locks of fd1 cover the region once fd2 is gone
+    rl_close(rl_fd2);
+    lck.l_type = F_RDLCK;
+    if (0 != rl_fcntl(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+    lck.l_start = 0;
+    lck.l_len   = 20;
+    if (0 != rl_upgrade(rl_fd1, F_SETLK, &lck))
+    {
+        return false;
+    }
+
+    return (0 == rl_close(rl_fd1));
+}
+
 int main(int argc, const char *argv[])
 {
     if (argc != 3)
@@ -460,6 +2562,34 @@ int main(int argc, const char *argv[])
     TEST_EXEC(test_regions(argv[1]), "test_regions", 2);
     TEST_EXEC(test_cross_process(argv[1], indexTest), "test_cross_process", 3);
     TEST_EXEC(test_record_blocking_request(argv[1]), "test_record_blocking_request", 4);
+    TEST_EXEC(test_many_locks(argv[1]), "test_many_locks", 5);
+    TEST_EXEC(test_read_fast_path(argv[1]), "test_read_fast_path", 6);
+    TEST_EXEC(test_dead_owner(argv[1]), "test_dead_owner", 7);
+    TEST_EXEC(test_batch(argv[1]), "test_batch", 8);
+    TEST_EXEC(test_many_descriptors(argv[1]), "test_many_descriptors", 9);
+    TEST_EXEC(test_query(argv[1]), "test_query", 10);
+    TEST_EXEC(test_timed_lock(argv[1]), "test_timed_lock", 11);
+    TEST_EXEC(test_deadlock(argv[1]), "test_deadlock", 12);
+    TEST_EXEC(test_policy(argv[1]), "test_policy", 13);
+    TEST_EXEC(test_upgrade(argv[1]), "test_upgrade", 14);
+    TEST_EXEC(test_thread_owner(argv[1]), "test_thread_owner", 15);
+    TEST_EXEC(test_fork_references(argv[1]), "test_fork_references", 16);
+    TEST_EXEC(test_lazy_fork(argv[1]), "test_lazy_fork", 17);
+    TEST_EXEC(test_range(argv[1]), "test_range", 18);
+    TEST_EXEC(test_stats(argv[1]), "test_stats", 19);
+    TEST_EXEC(test_snapshot(argv[1]), "test_snapshot", 20);
+    TEST_EXEC(test_hold_histogram(argv[1]), "test_hold_histogram", 21);
+    TEST_EXEC(test_reshape(argv[1]), "test_reshape", 22);
+    TEST_EXEC(test_fast_touching(argv[1]), "test_fast_touching", 23);
+    TEST_EXEC(test_many_files(argv[1]), "test_many_files", 24);
+    TEST_EXEC(test_targeted_wakeup(argv[1]), "test_targeted_wakeup", 25);
+    TEST_EXEC(test_no_named_semaphore(argv[1]), "test_no_named_semaphore", 26);
+    TEST_EXEC(test_dead_creator(argv[1]), "test_dead_creator", 27);
+    TEST_EXEC(test_recreate(argv[1]), "test_recreate", 28);
+    TEST_EXEC(test_racing_open(argv[1]), "test_racing_open", 29);
+    TEST_EXEC(test_dead_fast_slot(argv[1]), "test_dead_fast_slot", 30);
+    TEST_EXEC(test_fork_unrelated(argv[1]), "test_fork_unrelated", 31);
+    TEST_EXEC(test_change_unheld(argv[1]), "test_change_unheld", 32);
 
 lExit:
     printf("[%d] exit process\n", getpid());
@@ -0,0 +1,263 @@
+#include "rl_lock_library.h"
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+
+#define PROC_ERROR(Message) { fprintf(stderr, "%s : error {%s} in file {%s} on line {%d}\n", \
+                                                Message, strerror(errno), __FILE__, __LINE__); }\
+
+#define LSOF_SHM_DIR        "/dev/shm"
+#define LSOF_PREFIX         "f_"            /* shared objects of the library are named "/f_dev_ino" */
+#define LSOF_RETRIES        100             /* snapshot attempts of a busy file */
+#define LSOF_RETRY_DELAY    1000            /* us between two attempts */
+#define LSOF_MAX_FILES      64
+
+typedef struct
+{
+    bool            isJson;
+    off_t           start;      /* entries overlapping [start..end[ are listed */
+    off_t           end;
+    pid_t           pid;        /* 0 - any process */
+    int             nbFiles;    /* 0 - any file */
+    dev_t           devs[LSOF_MAX_FILES];
+    ino_t           inos[LSOF_MAX_FILES];
+} lsof_filter;
+
+static const char *g_kinds[]    = {"lock", "fast", "waiter"};
+static const char *g_policies[] = {"readers", "writers", "fifo"};
+
+//==============================================================================================================
+// snapshots
+
+/* snapshot of a shared object, grown until it fits; NULL if it isn't a rl_lock_library object or is gone */
+static struct rl_snapshot *take_snapshot(const char *name)
+{
+    size_t              size = sizeof(struct rl_snapshot) + 256 * sizeof(rl_snapshot_entry);
+    struct rl_snapshot *snap = NULL;
+
+    for (int attempt = 0; attempt < LSOF_RETRIES; attempt++)
+    {
+        struct rl_snapshot *larger = realloc(snap, size);
+        if (!larger)
+        {
+            PROC_ERROR("realloc() failure");
+            break;
+        }
+        snap = larger;
+
+        ssize_t len = rl_snapshot_shared(name, snap, size);
+        if ((len >= 0) && ((size_t)len <= size))
+        {
+            return snap;
+        }
+        if (len >= 0)
+        {
+            size = (size_t)len;
+        }
+        else if (errno == EAGAIN)
+        {
+            usleep(LSOF_RETRY_DELAY);
+        }
+        else
+        {
+            if (errno != EPROTO && errno != ENOENT)
+            {
+                fprintf(stderr, "%s : %s\n", name, strerror(errno));
+            }
+            break;
+        }
+    }
+
+    free(snap);
+    return NULL;
+}
+
+static bool is_file_selected(const lsof_filter *filter, const struct rl_snapshot *snap)
+{
+    for (int i = 0; i < filter->nbFiles; i++)
+    {
+        if ((filter->devs[i] == snap->dev) && (filter->inos[i] == snap->ino))
+        {
+            return true;
+        }
+    }
+    return (0 == filter->nbFiles);
+}
+
+static bool is_entry_selected(const lsof_filter *filter, const rl_snapshot_entry *e)
+{
+    off_t end = (e->len) ? e->start + e->len : INT64_MAX;
+    return (e->start < filter->end) && (filter->start < end) && ((0 == filter->pid) || (filter->pid == e->pid));
+}
+
+//==============================================================================================================
+// output
+
+static void print_text(const char *name, const struct rl_snapshot *snap, const lsof_filter *filter)
+{
+    printf("%s dev %ld ino %ld refs %d policy %s creator %d\n", name, (long)snap->dev, (long)snap->ino, snap->refs,
+           g_policies[(unsigned)snap->policy % 3], snap->creator);
+    printf("  acquisitions %lu conflicts %lu waits %lu wait %.3f ms (max %.3f ms) wakeups %lu (spurious %lu)\n",
+           snap->stats.acquisitions, snap->stats.conflicts, snap->stats.waits, snap->stats.wait_ns / 1e6,
+           snap->stats.max_wait_ns / 1e6, snap->stats.wakeups, snap->stats.spurious_wakeups);
+    printf("  %-7s %-4s %20s %20s %8s %5s %s\n", "KIND", "TYPE", "START", "END", "PID", "FD", "TOKEN");
+
+    for (size_t i = 0; i < snap->nb_entries; i++)
+    {
+        const rl_snapshot_entry *e = &snap->entries[i];
+        if (!is_entry_selected(filter, e))
+        {
+            continue;
+        }
+
+        char end[24] = "EOF";
+        if (e->len)
+        {
+            snprintf(end, sizeof(end), "%ld", (long)(e->start + e->len - 1));
+        }
+        printf("  %-7s %-4s %20ld %20s %8d %5d %lu\n", g_kinds[(unsigned)e->kind % 3],
+               (e->type == F_RDLCK) ? "RD" : "WR", (long)e->start, end, e->pid, e->des, e->token);
+    }
+}
+
+static void print_json(const char *name, const struct rl_snapshot *snap, const lsof_filter *filter, bool isFirst)
+{
+    printf("%s  {\"name\": \"%s\", \"dev\": %ld, \"ino\": %ld, \"version\": %u, \"creator\": %d, \"refs\": %d, "
+           "\"policy\": \"%s\", \"seq\": %u,\n", (isFirst) ? "" : ",\n", name, (long)snap->dev, (long)snap->ino,
+           snap->version, snap->creator, snap->refs, g_policies[(unsigned)snap->policy % 3], snap->seq);
+    printf("   \"stats\": {\"acquisitions\": %lu, \"conflicts\": %lu, \"waits\": %lu, \"wait_ns\": %lu, "
+           "\"max_wait_ns\": %lu, \"wakeups\": %lu, \"spurious_wakeups\": %lu, \"merges\": %lu, \"splits\": %lu},\n",
+           snap->stats.acquisitions, snap->stats.conflicts, snap->stats.waits, snap->stats.wait_ns,
+           snap->stats.max_wait_ns, snap->stats.wakeups, snap->stats.spurious_wakeups, snap->stats.merges,
+           snap->stats.splits);
+    printf("   \"entries\": [");
+
+    bool isFirstEntry = true;
+    for (size_t i = 0; i < snap->nb_entries; i++)
+    {
+        const rl_snapshot_entry *e = &snap->entries[i];
+        if (!is_entry_selected(filter, e))
+        {
+            continue;
+        }
+        printf("%s\n    {\"kind\": \"%s\", \"type\": \"%s\", \"start\": %ld, \"len\": %ld, \"pid\": %d, \"fd\": %d, "
+               "\"token\": %lu}", (isFirstEntry) ? "" : ",", g_kinds[(unsigned)e->kind % 3],
+               (e->type == F_RDLCK) ? "RD" : "WR", (long)e->start, (long)e->len, e->pid, e->des, e->token);
+        isFirstEntry = false;
+    }
+    printf("]}");
+}
+
+//==============================================================================================================
+// arguments
+
+static bool parse_range(const char *arg, lsof_filter *filter)
+{
+    char *next = NULL;
+    long  len  = 1;
+
+    errno         = 0;
+    filter->start = strtol(arg, &next, 0);
+    if (*next == ':')
+    {
+        len = strtol(next + 1, &next, 0);
+    }
+    if ((errno) || (*next) || (filter->start < 0) || (len < 0))
+    {
+        return false;
+    }
+    filter->end = (len) ? filter->start + len : INT64_MAX;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    lsof_filter filter = {.isJson = false, .start = 0, .end = INT64_MAX, .pid = 0, .nbFiles = 0};
+    int         res    = EXIT_SUCCESS;
+    int         opt;
+
+    while (-1 != (opt = getopt(argc, argv, "jr:p:")))
+    {
+        if      ('j' == opt) { filter.isJson = true;                   }
+        else if ('p' == opt) { filter.pid    = (pid_t)atoi(optarg);    }
+        else if (('r' == opt) && (parse_range(optarg, &filter)))       { }
+        else
+        {
+            fprintf(stderr, "usage: %s [-j] [-r offset[:len]] [-p pid] [file...]\n"
+                            "lists locks and waiters of the files locked with rl_lock_library (all of them by default)\n"
+                            "  -j                JSON output\n"
+                            "  -r offset[:len]   only entries overlapping the region, len 0 - to the end of file\n"
+                            "  -p pid            only entries of the process\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        struct stat statBuffer;
+        if (filter.nbFiles == LSOF_MAX_FILES)
+        {
+            fprintf(stderr, "at most %d files\n", LSOF_MAX_FILES);
+            return EXIT_FAILURE;
+        }
+        if (0 > stat(argv[i], &statBuffer))
+        {
+            fprintf(stderr, "%s : %s\n", argv[i], strerror(errno));
+            return EXIT_FAILURE;
+        }
+        filter.devs[filter.nbFiles] = statBuffer.st_dev;
+        filter.inos[filter.nbFiles] = statBuffer.st_ino;
+        filter.nbFiles++;
+    }
+
+    DIR *dir = opendir(LSOF_SHM_DIR);
+    if (!dir)
+    {
+        PROC_ERROR("opendir() failure");
+        return EXIT_FAILURE;
+    }
+
+    bool           isFirst = true;
+    struct dirent *entry;
+    if (filter.isJson)
+    {
+        printf("[\n");
+    }
+    while (NULL != (entry = readdir(dir)))
+    {
+        char name[sizeof(entry->d_name) + 1];
+        if (0 != strncmp(entry->d_name, LSOF_PREFIX, strlen(LSOF_PREFIX)))
+        {
+            continue;
+        }
+        snprintf(name, sizeof(name), "/%s", entry->d_name);
+
+        struct rl_snapshot *snap = take_snapshot(name);
+        if ((snap) && (is_file_selected(&filter, snap)))
+        {
+            if (filter.isJson)
+            {
+                print_json(name, snap, &filter, isFirst);
+            }
+            else
+            {
+                print_text(name, snap, &filter);
+            }
+            isFirst = false;
+        }
+        free(snap);
+    }
+    if (filter.isJson)
+    {
+        printf("\n]\n");
+    }
+    closedir(dir);
+
+    //files given by name must all have been found
+    if ((filter.nbFiles) && (isFirst))
+    {
+        fprintf(stderr, "no lock state found\n");
+        res = EXIT_FAILURE;
+    }
+    return res;
+}